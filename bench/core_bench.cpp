@@ -0,0 +1,272 @@
+// Бенчмарки подсистем, работающих внутри процесса: разбор строки,
+// встроенные команды, история, журнал аудита
+
+#include "harness.h"
+
+#include "audit.h"
+#include "commands.h"
+#include "eventloop.h"
+#include "history.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+KUBSH_BENCH(utils_split)
+{
+    const std::string line = "grep -rn \"struct inotify_event\" src/vfs.cpp --color=never -A 3";
+    std::size_t n = ctx.iterations(1000000);
+
+    std::size_t tokens = 0;
+    double begin = Bench::now();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        tokens += Utils::split(line).size();
+    }
+    double elapsed = Bench::now() - begin;
+
+    ctx.report("lines_per_sec", n / elapsed);
+    ctx.report("ns_per_line", elapsed * 1e9 / n);
+    ctx.report("mb_per_sec", n * line.size() / elapsed / 1e6);
+    ctx.report("tokens", static_cast<double>(tokens / n));
+}
+
+KUBSH_BENCH(builtin_dispatch)
+{
+    std::size_t n = ctx.iterations(1000000);
+    const std::vector<std::string> echo = {"echo", "hello", "world"};
+    const std::vector<std::string> miss = {"ls", "-la"};
+
+    // Вывод echo уходит в никуда, чтобы мерить диспетчер, а не терминал
+    std::ostringstream sink;
+    std::streambuf *saved = std::cout.rdbuf(sink.rdbuf());
+
+    double begin = Bench::now();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        Commands::handleCommand(echo);
+        if ((i & 1023) == 0)
+            sink.str(std::string());
+    }
+    double echoElapsed = Bench::now() - begin;
+
+    begin = Bench::now();
+    std::size_t handled = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        handled += Commands::handleCommand(miss);
+    }
+    double missElapsed = Bench::now() - begin;
+
+    std::cout.rdbuf(saved);
+
+    ctx.report("echo_ns_per_call", echoElapsed * 1e9 / n);
+    ctx.report("miss_ns_per_call", missElapsed * 1e9 / n);
+    ctx.report("miss_handled", static_cast<double>(handled));
+}
+
+// Поиск назад, как его сделал бы Ctrl+R: последняя запись с индексом < before,
+// содержащая needle, или History::size(). Оболочке он пока не нужен, поэтому живёт здесь
+static std::size_t findBefore(std::string_view needle, std::size_t before)
+{
+    while (before > 0)
+    {
+        --before;
+        if (History::at(before).find(needle) != std::string_view::npos)
+            return before;
+    }
+    return History::size();
+}
+
+// История статична на весь процесс, поэтому загрузка, поиск и дописывание
+// меряются в одном случае над одним временным HOME
+KUBSH_BENCH(history)
+{
+    static Bench::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+
+    std::size_t entries = ctx.iterations(1000000);
+    {
+        std::ofstream out(home.path() + "/.kubsh_history");
+        for (std::size_t i = 0; i < entries; ++i)
+        {
+            out << "make -C build target" << i << " -j8\n";
+        }
+    }
+
+    double begin = Bench::now();
+    History::load();
+    double loadElapsed = Bench::now() - begin;
+    ctx.report("entries", static_cast<double>(History::size()));
+    ctx.report("load_ms", loadElapsed * 1e3);
+
+    // Поиск записи у самого начала — худший случай для поиска назад
+    std::size_t searches = ctx.iterations(20);
+    std::size_t found = 0;
+    begin = Bench::now();
+    for (std::size_t i = 0; i < searches; ++i)
+    {
+        found += findBefore("target1 ", History::size()) < History::size();
+    }
+    double searchElapsed = Bench::now() - begin;
+    ctx.report("search_ms", searchElapsed * 1e3 / searches);
+    ctx.report("search_found", static_cast<double>(found));
+
+    std::size_t navigations = ctx.iterations(1000000);
+    volatile std::size_t bytes = 0;
+    begin = Bench::now();
+    for (std::size_t i = 0; i < navigations; ++i)
+    {
+        bytes += History::prev().size();
+    }
+    double navElapsed = Bench::now() - begin;
+    ctx.report("prev_ns", navElapsed * 1e9 / navigations);
+
+    std::size_t appends = ctx.iterations(10000);
+    begin = Bench::now();
+    for (std::size_t i = 0; i < appends; ++i)
+    {
+        History::append("echo appended " + std::to_string(i));
+        // Как в оболочке: после каждой команды цикл отправляет запись, ожидая ввода
+        EventLoop::runOnce(0);
+    }
+    EventLoop::flush();
+    double appendElapsed = Bench::now() - begin;
+    ctx.report("appends_per_sec", appends / appendElapsed);
+}
+
+// Запись журнала аудита — цена каждой команды; запросы — поиск по большому журналу.
+// Одна команда из 100000 завершается с кодом 7, запрос по ней должен пропускать блоки по заголовку
+KUBSH_BENCH(audit)
+{
+    static Bench::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+    const std::string log = home.path() + "/.kubsh_audit";
+
+    std::size_t n = ctx.iterations(1000000);
+    std::vector<std::string> args = {"make", "-C", "build", "target", "-j8"};
+    std::string recentSince;
+
+    double begin = Bench::now();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (i == n - n / 10)
+            recentSince = "@" + std::to_string(std::time(nullptr));
+        args[3] = "target" + std::to_string(i % 1000);
+        Audit::begin(args);
+        Audit::end(i % 100000 == 99999 ? 7 : (i % 50 == 0 ? 1 : 0));
+    }
+    Audit::flush();
+    double recordElapsed = Bench::now() - begin;
+
+    struct stat st{};
+    stat(log.c_str(), &st);
+    ctx.report("record_ns", recordElapsed * 1e9 / n);
+    ctx.report("bytes_per_record", static_cast<double>(st.st_size) / n);
+
+    std::ostringstream sink;
+    std::streambuf *saved = std::cout.rdbuf(sink.rdbuf());
+
+    begin = Bench::now();
+    Audit::query({"--status", "7"}, false);
+    double rareElapsed = Bench::now() - begin;
+    std::size_t rareBytes = sink.str().size();
+    sink.str(std::string());
+
+    begin = Bench::now();
+    Audit::query({"--since", recentSince, "--status", "failed"}, false);
+    double recentElapsed = Bench::now() - begin;
+    sink.str(std::string());
+
+    begin = Bench::now();
+    Audit::query({"--limit", "10"}, false);
+    double fullElapsed = Bench::now() - begin;
+
+    std::cout.rdbuf(saved);
+
+    ctx.report("query_rare_status_ms", rareElapsed * 1e3);
+    ctx.report("query_rare_status_bytes", static_cast<double>(rareBytes));
+    ctx.report("query_recent_failed_ms", recentElapsed * 1e3);
+    ctx.report("query_full_scan_ms", fullElapsed * 1e3);
+    ctx.report("full_scan_records_per_sec", n / fullElapsed);
+}
+
+// Падение посреди записи блока: журнал обрезан внутри последнего блока, потом дописан
+// новый. Заголовок оборванного блока цел и указывает за начало нового — запрос
+// не должен через него перепрыгнуть ни по индексу, ни при сканировании без индекса
+KUBSH_BENCH(audit_torn_tail)
+{
+    static Bench::TempDir home;
+    setenv("HOME", home.path().c_str(), 1);
+    const std::string log = home.path() + "/.kubsh_audit";
+    const std::size_t perBlock = ctx.iterations(200);
+
+    auto writeBlock = [&](const std::string &tag)
+    {
+        for (std::size_t i = 0; i < perBlock; ++i)
+        {
+            Audit::begin({"echo", tag, std::to_string(i * 7919)});
+            Audit::end(0);
+        }
+        Audit::flush();
+    };
+    auto fileSize = [&]
+    {
+        struct stat st{};
+        stat(log.c_str(), &st);
+        return static_cast<off_t>(st.st_size);
+    };
+
+    writeBlock("alpha");
+    writeBlock("beta");
+    off_t tornStart = fileSize();
+    writeBlock("gamma");
+    off_t tornEnd = fileSize();
+    if (truncate(log.c_str(), tornStart + (tornEnd - tornStart) / 2) != 0)
+    {
+        ctx.fail("audit_torn_tail: truncate failed");
+        return;
+    }
+    writeBlock("delta");
+
+    auto check = [&](const char *phase)
+    {
+        std::ostringstream sink;
+        std::streambuf *saved = std::cout.rdbuf(sink.rdbuf());
+        double begin = Bench::now();
+        Audit::query({"--log", log}, false);
+        double elapsed = Bench::now() - begin;
+        std::cout.rdbuf(saved);
+
+        std::string out = sink.str();
+        for (const char *tag : {"alpha", "beta", "gamma", "delta"})
+        {
+            std::size_t found = 0;
+            std::string needle = std::string(" echo ") + tag + " ";
+            for (std::size_t at = out.find(needle); at != std::string::npos; at = out.find(needle, at + 1))
+                ++found;
+            std::size_t expected = std::string_view(tag) == "gamma" ? 0 : perBlock;
+            if (found != expected)
+                ctx.fail(std::string("audit_torn_tail: ") + phase + ": " + std::to_string(found) + " " + tag +
+                         " record(s), expected " + std::to_string(expected));
+        }
+        ctx.report(std::string("query_") + phase + "_ms", elapsed * 1e3);
+    };
+
+    // Сообщение о повреждённом блоке — ожидаемое, в вывод бенчмарка оно не нужно
+    std::ostringstream errors;
+    std::streambuf *savedErr = std::cerr.rdbuf(errors.rdbuf());
+    check("indexed");
+    std::remove((log + ".idx").c_str());
+    check("scanned");
+    std::cerr.rdbuf(savedErr);
+}
@@ -0,0 +1,273 @@
+// kubsh_bench: набор бенчмарков подсистем kubsh с выводом в JSON
+//
+//   kubsh_bench [--filter SUBSTR] [--scale K] [--list]
+//
+// Результат печатается в stdout одним JSON-объектом, ход выполнения — в stderr.
+// Код завершения 1 — какая-то из проверок внутри случаев не прошла.
+
+#include "harness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#ifndef KUBSH_BINARY
+#define KUBSH_BINARY "kubsh"
+#endif
+
+namespace Bench
+{
+    struct Case
+    {
+        const char *name;
+        CaseFn fn;
+    };
+
+    static std::vector<Case> &registry()
+    {
+        static std::vector<Case> cases;
+        return cases;
+    }
+
+    bool registerCase(const char *name, CaseFn fn)
+    {
+        registry().push_back(Case{name, fn});
+        return true;
+    }
+
+    std::size_t Context::iterations(std::size_t base) const
+    {
+        return std::max<std::size_t>(1, static_cast<std::size_t>(std::llround(base * scale)));
+    }
+
+    void Context::report(const std::string &metric, double value)
+    {
+        values.emplace_back(metric, value);
+    }
+
+    void Context::fail(const std::string &why)
+    {
+        ++failures;
+        std::cerr << "kubsh_bench: FAILED: " << why << std::endl;
+    }
+
+    void Context::reportLatencies(const std::string &prefix, std::vector<double> samplesUs)
+    {
+        if (samplesUs.empty())
+            return;
+        std::sort(samplesUs.begin(), samplesUs.end());
+        auto at = [&](double p)
+        {
+            return samplesUs[static_cast<std::size_t>(p * (samplesUs.size() - 1))];
+        };
+        double sum = 0;
+        for (double s : samplesUs)
+            sum += s;
+
+        report(prefix + "_p50_us", at(0.5));
+        report(prefix + "_p99_us", at(0.99));
+        report(prefix + "_max_us", samplesUs.back());
+        report(prefix + "_ops_per_sec", samplesUs.size() / (sum / 1e6));
+    }
+
+    TempDir::TempDir()
+    {
+        char tmpl[] = "/tmp/kubsh-bench-XXXXXX";
+        if (!mkdtemp(tmpl))
+        {
+            std::perror("kubsh_bench: mkdtemp");
+            std::exit(1);
+        }
+        dir = tmpl;
+    }
+
+    TempDir::~TempDir()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(dir, ec);
+    }
+
+    std::string fakeUserToolsPath(const std::string &dir, const std::string &stateDir)
+    {
+        std::filesystem::create_directories(dir);
+        std::string adduser = "exit 0\n";
+        std::string deluser = "exit 0\n";
+        std::string usermod = "exit 0\n";
+        if (!stateDir.empty())
+        {
+            // adduser ... NAME; deluser NAME; usermod -l NEW OLD.
+            // Как настоящие, все три переписывают общий passwd под одним замком и,
+            // не взяв его, сразу завершаются с ошибкой (shadow-utils: "cannot lock /etc/passwd").
+            // Внутри замка — запуск внешней программы, чтобы гонка не пряталась в микросекундах
+            std::filesystem::create_directories(stateDir);
+            std::string s = "S='" + stateDir + "'\n"
+                            "mkdir \"$S.lock\" 2>/dev/null || exit 10\n"
+                            "trap 'rmdir \"$S.lock\"' EXIT\n"
+                            "/bin/true\n";
+            adduser = s + "for n; do :; done\n[ -e \"$S/$n\" ] && exit 1\n: > \"$S/$n\"\n";
+            deluser = s + "[ -e \"$S/$1\" ] || exit 1\nrm -f \"$S/$1\"\n";
+            usermod = s + "[ -e \"$S/$3\" ] && [ ! -e \"$S/$2\" ] || exit 1\nmv \"$S/$3\" \"$S/$2\"\n";
+        }
+        const std::pair<const char *, std::string> tools[] = {
+            {"adduser", adduser},
+            {"deluser", deluser},
+            {"usermod", usermod},
+        };
+        for (const auto &tool : tools)
+        {
+            std::string path = dir + "/" + tool.first;
+            std::ofstream(path) << "#!/bin/sh\n"
+                                << tool.second;
+            chmod(path.c_str(), 0755);
+        }
+        const char *path = std::getenv("PATH");
+        return dir + ":" + (path ? path : "/usr/bin:/bin");
+    }
+
+    int runKubsh(const std::vector<std::string> &args, const std::string &home, const std::string &stdinFile,
+                 const std::string &stdoutFile)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int in = open(stdinFile.empty() ? "/dev/null" : stdinFile.c_str(), O_RDONLY);
+            int out = stdoutFile.empty() ? open("/dev/null", O_WRONLY)
+                                         : open(stdoutFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(in, STDIN_FILENO);
+            dup2(out, STDOUT_FILENO);
+            setenv("HOME", home.c_str(), 1);
+
+            std::vector<char *> argv;
+            argv.push_back(const_cast<char *>("kubsh"));
+            for (const auto &a : args)
+                argv.push_back(const_cast<char *>(a.c_str()));
+            argv.push_back(nullptr);
+            execv(KUBSH_BINARY, argv.data());
+            std::perror("kubsh_bench: exec kubsh");
+            _exit(127);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    static std::string jsonEscape(const std::string &s)
+    {
+        std::string out;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                out += ' ';
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+        return out;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filter;
+    double scale = 1.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+        {
+            scale = std::strtod(argv[++i], nullptr);
+        }
+        else if (std::strcmp(argv[i], "--list") == 0)
+        {
+            for (const auto &c : Bench::registry())
+                std::cout << c.name << std::endl;
+            return 0;
+        }
+        else
+        {
+            std::cerr << "usage: kubsh_bench [--filter SUBSTR] [--scale K] [--list]" << std::endl;
+            return 2;
+        }
+    }
+
+    // Подсистемы пишут диагностику в stdout (например, [vfs]); JSON выводим в исходный
+    // stdout, а всё остальное на время прогона уводим в stderr
+    std::cout.flush();
+    int jsonFd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    struct utsname host{};
+    uname(&host);
+
+    std::ostringstream json;
+    json.precision(6);
+    json << "{\"host\":\"" << Bench::jsonEscape(host.nodename) << "\","
+         << "\"kernel\":\"" << Bench::jsonEscape(host.release) << "\","
+         << "\"timestamp\":" << std::time(nullptr) << ","
+         << "\"scale\":" << scale << ","
+         << "\"cases\":[";
+
+    bool first = true;
+    bool failed = false;
+    for (const auto &c : Bench::registry())
+    {
+        if (!filter.empty() && std::string(c.name).find(filter) == std::string::npos)
+            continue;
+
+        std::cerr << "kubsh_bench: " << c.name << "..." << std::endl;
+        Bench::Context ctx(scale);
+        double begin = Bench::now();
+        c.fn(ctx);
+        double elapsed = Bench::now() - begin;
+
+        json << (first ? "" : ",") << "{\"name\":\"" << c.name << "\",\"wall_sec\":" << elapsed << ",\"metrics\":{";
+        bool firstMetric = true;
+        for (const auto &m : ctx.metrics())
+        {
+            json << (firstMetric ? "" : ",") << "\"" << Bench::jsonEscape(m.first) << "\":" << m.second;
+            firstMetric = false;
+        }
+        json << "}";
+        if (ctx.failed())
+        {
+            json << ",\"failed\":true";
+            failed = true;
+        }
+        json << "}";
+        first = false;
+    }
+    json << "]}\n";
+
+    std::cout.flush();
+    std::string out = json.str();
+    if (write(jsonFd, out.data(), out.size()) != static_cast<ssize_t>(out.size()))
+    {
+        std::perror("kubsh_bench: write");
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Bench
+{
+    class Context
+    {
+    public:
+        explicit Context(double scale) : scale(scale) {}
+
+        // Число итераций с учётом --scale (не меньше 1)
+        std::size_t iterations(std::size_t base) const;
+
+        // Добавляет метрику в результат текущего случая
+        void report(const std::string &metric, double value);
+
+        // Отчёт по выборке задержек в микросекундах: p50/p99/max и ops/s
+        void reportLatencies(const std::string &prefix, std::vector<double> samplesUs);
+
+        // Проверка в случае не прошла: причина печатается в stderr,
+        // в JSON у случая появляется "failed":true, а kubsh_bench завершается с кодом 1
+        void fail(const std::string &why);
+
+        const std::vector<std::pair<std::string, double>> &metrics() const { return values; }
+        bool failed() const { return failures > 0; }
+
+    private:
+        double scale;
+        std::vector<std::pair<std::string, double>> values;
+        std::size_t failures = 0;
+    };
+
+    using CaseFn = void (*)(Context &);
+
+    bool registerCase(const char *name, CaseFn fn);
+
+    // Монотонное время в секундах от произвольной точки
+    inline double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Временный каталог, удаляется при разрушении
+    class TempDir
+    {
+    public:
+        TempDir();
+        ~TempDir();
+        TempDir(const TempDir &) = delete;
+        TempDir &operator=(const TempDir &) = delete;
+
+        const std::string &path() const { return dir; }
+
+    private:
+        std::string dir;
+    };
+
+    // Каталог с фиктивными adduser/deluser/usermod, чтобы VFS не трогал настоящих пользователей.
+    // Возвращает PATH, в котором этот каталог стоит первым. Если задан stateDir, инструменты
+    // ведут в нём по файлу на «системного» пользователя и, как настоящие, отказывают
+    // при повторном создании или удалении несуществующего, а также если замок общего
+    // passwd (stateDir.lock) занят другим инструментом.
+    std::string fakeUserToolsPath(const std::string &dir, const std::string &stateDir = std::string());
+
+    // Запускает kubsh с аргументами args и HOME=home; stdin — файл stdinFile, stdout — файл
+    // stdoutFile (пустая строка — /dev/null). Возвращает код завершения.
+    int runKubsh(const std::vector<std::string> &args, const std::string &home, const std::string &stdinFile,
+                 const std::string &stdoutFile = std::string());
+}
+
+#define KUBSH_BENCH(name)                                  \
+    static void bench_##name(Bench::Context &ctx);         \
+    static const bool bench_##name##_registered =          \
+        Bench::registerCase(#name, bench_##name);          \
+    static void bench_##name(Bench::Context &ctx)
+
+#endif // BENCH_HARNESS_H
@@ -0,0 +1,398 @@
+// Бенчмарки запуска процессов: внешние команды, пакетный режим, старт kubsh,
+// сервер и помощник запуска
+
+#include "harness.h"
+
+#include "config.h"
+#include "executor.h"
+#include "server.h"
+#include "zygote.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifndef KUBSH_BINARY
+#define KUBSH_BINARY "kubsh"
+#endif
+
+KUBSH_BENCH(executor_spawn)
+{
+    std::size_t n = ctx.iterations(500);
+    const std::vector<std::string> args = {"true"};
+
+    std::vector<double> samples;
+    samples.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        double begin = Bench::now();
+        Executor::runExternal(args);
+        samples.push_back((Bench::now() - begin) * 1e6);
+    }
+    ctx.reportLatencies("spawn", samples);
+}
+
+// Сценарий подаётся на stdin (построчный интерактивный цикл) и как файл (kubsh script)
+KUBSH_BENCH(batch_script)
+{
+    Bench::TempDir home;
+    std::string script = home.path() + "/script.ksh";
+
+    std::size_t builtins = ctx.iterations(20000);
+    {
+        std::ofstream out(script);
+        for (std::size_t i = 0; i < builtins; ++i)
+            out << "echo line " << i << "\n";
+    }
+    double begin = Bench::now();
+    Bench::runKubsh({}, home.path(), script);
+    double elapsed = Bench::now() - begin;
+    ctx.report("builtin_lines_per_sec", builtins / elapsed);
+
+    // Тот же сценарий через канал: kubsh не может вернуть лишнее через lseek
+    // и забирает ровно по строке, подсмотрев её через tee()
+    std::string fifo = home.path() + "/script.fifo";
+    mkfifo(fifo.c_str(), 0600);
+    pid_t writer = fork();
+    if (writer == 0)
+    {
+        int out = open(fifo.c_str(), O_WRONLY);
+        dup2(out, STDOUT_FILENO);
+        execlp("cat", "cat", script.c_str(), nullptr);
+        _exit(127);
+    }
+    begin = Bench::now();
+    Bench::runKubsh({}, home.path(), fifo);
+    elapsed = Bench::now() - begin;
+    waitpid(writer, nullptr, 0);
+    ctx.report("piped_lines_per_sec", builtins / elapsed);
+
+    std::size_t externals = ctx.iterations(300);
+    {
+        std::ofstream out(script);
+        for (std::size_t i = 0; i < externals; ++i)
+            out << "true\n";
+    }
+    begin = Bench::now();
+    Bench::runKubsh({}, home.path(), script);
+    elapsed = Bench::now() - begin;
+    ctx.report("external_lines_per_sec", externals / elapsed);
+
+    // Файл сценария разбирается целиком заранее; && / || вычисляются в процессе
+    std::size_t chained = ctx.iterations(20000);
+    {
+        std::ofstream out(script);
+        for (std::size_t i = 0; i < chained; ++i)
+            out << "echo a " << i << " && echo b || echo skipped; cd .\n";
+    }
+    begin = Bench::now();
+    Bench::runKubsh({script}, home.path(), "");
+    elapsed = Bench::now() - begin;
+    ctx.report("chained_script_lines_per_sec", chained / elapsed);
+}
+
+// Время от fork до первого приглашения на большой истории и каталоге ~/users
+KUBSH_BENCH(startup)
+{
+    Bench::TempDir home;
+    {
+        std::ofstream history(home.path() + "/.kubsh_history");
+        std::size_t entries = ctx.iterations(1000000);
+        for (std::size_t i = 0; i < entries; ++i)
+            history << "git commit -m \"change " << i << "\"\n";
+    }
+    for (std::size_t i = 0, users = ctx.iterations(2000); i < users; ++i)
+    {
+        std::string dir = home.path() + "/users/user" + std::to_string(i);
+        std::filesystem::create_directories(dir);
+        std::ofstream(dir + "/id") << -1;
+        std::ofstream(dir + "/home") << "UNKNOWN";
+        std::ofstream(dir + "/shell") << "UNKNOWN";
+    }
+
+    const std::string prompt = "kubsh> ";
+    std::size_t runs = ctx.iterations(50);
+    std::vector<double> samples;
+
+    for (std::size_t i = 0; i <= runs; ++i)
+    {
+        int in[2], out[2];
+        if (pipe(in) == -1 || pipe(out) == -1)
+            return;
+
+        double begin = Bench::now();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            dup2(in[0], STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            close(in[0]);
+            close(in[1]);
+            close(out[0]);
+            close(out[1]);
+            setenv("HOME", home.path().c_str(), 1);
+            execl(KUBSH_BINARY, "kubsh", nullptr);
+            _exit(127);
+        }
+        close(in[0]);
+        close(out[1]);
+
+        std::string seen;
+        char buf[256];
+        while (seen.find(prompt) == std::string::npos)
+        {
+            ssize_t n = read(out[0], buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            seen.append(buf, static_cast<std::size_t>(n));
+        }
+        double elapsed = Bench::now() - begin;
+
+        // Закрытый stdin завершает сессию
+        close(in[1]);
+        while (read(out[0], buf, sizeof(buf)) > 0)
+        {
+        }
+        close(out[0]);
+        waitpid(pid, nullptr, 0);
+
+        // Первый запуск — прогрев
+        if (i > 0)
+            samples.push_back(elapsed * 1e6);
+    }
+    ctx.reportLatencies("first_prompt", samples);
+}
+
+// Запускает kubsh --server с сокетом в home (KUBSH_SOCKET остаётся выставленным
+// до stopServer) и ждёт, пока он начнёт отвечать
+static pid_t startServer(const Bench::TempDir &home)
+{
+    std::string socket = home.path() + "/kubsh.sock";
+    std::string fakePath = Bench::fakeUserToolsPath(home.path() + "/fakebin");
+    setenv("KUBSH_SOCKET", socket.c_str(), 1);
+
+    pid_t server = fork();
+    if (server == 0)
+    {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDERR_FILENO);
+        setenv("HOME", home.path().c_str(), 1);
+        setenv("PATH", fakePath.c_str(), 1);
+        execl(KUBSH_BINARY, "kubsh", "--server", nullptr);
+        _exit(127);
+    }
+
+    int null = open("/dev/null", O_RDWR);
+    const int fds[3] = {null, null, null};
+    double deadline = Bench::now() + 5.0;
+    while (Server::request("true", fds) == -1 && Bench::now() < deadline)
+    {
+        usleep(1000);
+    }
+    close(null);
+    return server;
+}
+
+static void stopServer(pid_t server)
+{
+    kill(server, SIGINT);
+    waitpid(server, nullptr, 0);
+    unsetenv("KUBSH_SOCKET");
+}
+
+// Команды через резидентный сервер против холодного kubsh -c
+KUBSH_BENCH(server_throughput)
+{
+    Bench::TempDir home;
+    pid_t server = startServer(home);
+
+    int null = open("/dev/null", O_RDWR);
+    const int fds[3] = {null, null, null};
+
+    std::size_t n = ctx.iterations(500);
+
+    double begin = Bench::now();
+    for (std::size_t i = 0; i < n; ++i)
+        Server::request("echo x", fds);
+    ctx.report("server_request_cmds_per_sec", n / (Bench::now() - begin));
+
+    begin = Bench::now();
+    for (std::size_t i = 0; i < n; ++i)
+        Bench::runKubsh({"--client", "echo", "x"}, home.path(), "");
+    ctx.report("server_client_cmds_per_sec", n / (Bench::now() - begin));
+
+    begin = Bench::now();
+    for (std::size_t i = 0; i < n; ++i)
+        Bench::runKubsh({"-c", "echo x"}, home.path(), "");
+    ctx.report("cold_c_cmds_per_sec", n / (Bench::now() - begin));
+
+    close(null);
+    stopServer(server);
+}
+
+// kubsh --client передаёт argv серверу без искажений: кавычки, обратные слэши,
+// пробелы и операторы внутри аргументов доходят до команды как есть.
+// (~ не проверяется: его раскрывает Executor, как и для локальной команды)
+KUBSH_BENCH(server_argv)
+{
+    Bench::TempDir home;
+    pid_t server = startServer(home);
+    std::string out = home.path() + "/out";
+
+    const std::vector<std::vector<std::string>> cases = {
+        {"plain", "two words"},
+        {"a\"b", "\"", "\"\""},
+        {"back\\slash", "\\", "end\\"},
+        {"semi;colon", "a && b", "x | y", "bg &"},
+        {"tab\there", "new\nline", "$HOME"},
+        {"mixed \"q\" \\ ;"},
+    };
+
+    std::size_t passed = 0;
+    double begin = Bench::now();
+    for (const auto &args : cases)
+    {
+        std::vector<std::string> argv = {"--client", "printf", "[%s]"};
+        std::string expected;
+        for (const auto &arg : args)
+        {
+            argv.push_back(arg);
+            expected += "[" + arg + "]";
+        }
+
+        int status = Bench::runKubsh(argv, home.path(), "", out);
+        std::ifstream in(out, std::ios::binary);
+        std::string got((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (status == 0 && got == expected)
+            ++passed;
+        else
+            ctx.fail("server_argv: expected " + expected + ", got " + got + " (status " + std::to_string(status) + ")");
+    }
+    ctx.report("round_trip_ms", (Bench::now() - begin) * 1e3 / cases.size());
+    ctx.report("passed", static_cast<double>(passed));
+    ctx.report("cases", static_cast<double>(cases.size()));
+
+    stopServer(server);
+}
+
+// Задержка запуска по ходу «старения» процесса: куча растёт, потоки добавляются.
+// Прямой fork дорожает вместе с адресным пространством, запуск через помощника — нет.
+// Длительность — 10 с × --scale (--scale 360 даёт часовой прогон). Старение растянуто
+// на весь прогон, а задержки считаются по десятым долям времени: fork_t0..fork_t9
+// показывают, как меняется запуск от молодого процесса к старому.
+KUBSH_BENCH(spawn_soak)
+{
+    Bench::TempDir home;
+    std::string zygoteOn = home.path() + "/zygote.rc";
+    std::string zygoteOff = home.path() + "/fork.rc";
+    std::ofstream(zygoteOn) << "zygote = on\n";
+    std::ofstream(zygoteOff) << "zygote = off\n";
+
+    if (!Zygote::start(KUBSH_BINARY))
+    {
+        ctx.report("error", 1);
+        return;
+    }
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<char[]>> heap;
+    constexpr std::size_t chunk = 1 << 20;
+    constexpr std::size_t maxHeapChunks = 512;
+    constexpr std::size_t maxThreads = 16;
+    constexpr std::size_t intervals = 10;
+
+    const std::vector<std::string> args = {"true"};
+    std::vector<double> forkSamples, zygoteSamples;
+    std::vector<std::vector<double>> forkByInterval(intervals), zygoteByInterval(intervals);
+    double start = Bench::now();
+    double duration = static_cast<double>(ctx.iterations(10));
+
+    while (true)
+    {
+        double elapsed = Bench::now() - start;
+        if (elapsed >= duration)
+            break;
+        double age = elapsed / duration;
+        std::size_t interval = std::min(intervals - 1, static_cast<std::size_t>(age * intervals));
+
+        // Старение пропорционально прошедшему времени: к концу прогона — 512 МБ
+        // затронутой кучи и 16 потоков
+        while (heap.size() < static_cast<std::size_t>(age * maxHeapChunks) + 1)
+        {
+            heap.emplace_back(new char[chunk]);
+            std::memset(heap.back().get(), 1, chunk);
+        }
+        while (threads.size() < static_cast<std::size_t>(age * maxThreads) + 1)
+        {
+            threads.emplace_back([&stop]
+                                 {
+                                     while (!stop)
+                                         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                                 });
+        }
+
+        setenv("KUBSH_CONFIG", zygoteOff.c_str(), 1);
+        Config::reload();
+        double begin = Bench::now();
+        Executor::runExternal(args);
+        forkSamples.push_back((Bench::now() - begin) * 1e6);
+        forkByInterval[interval].push_back(forkSamples.back());
+
+        setenv("KUBSH_CONFIG", zygoteOn.c_str(), 1);
+        Config::reload();
+        begin = Bench::now();
+        Executor::runExternal(args);
+        zygoteSamples.push_back((Bench::now() - begin) * 1e6);
+        zygoteByInterval[interval].push_back(zygoteSamples.back());
+    }
+
+    stop = true;
+    for (auto &t : threads)
+        t.join();
+    unsetenv("KUBSH_CONFIG");
+    Config::reload();
+
+    auto percentile = [](std::vector<double> samples, double p)
+    {
+        if (samples.empty())
+            return 0.0;
+        std::sort(samples.begin(), samples.end());
+        return samples[static_cast<std::size_t>(p * (samples.size() - 1))];
+    };
+
+    // Дрейф: медиана последней десятой части прогона против первой
+    auto drift = [&](const std::vector<std::vector<double>> &byInterval)
+    {
+        double early = percentile(byInterval.front(), 0.5);
+        return early > 0 ? percentile(byInterval.back(), 0.5) / early : 0.0;
+    };
+
+    ctx.report("heap_mb", static_cast<double>(heap.size()));
+    ctx.report("threads", static_cast<double>(threads.size()));
+    ctx.report("fork_drift", drift(forkByInterval));
+    ctx.report("zygote_drift", drift(zygoteByInterval));
+    ctx.reportLatencies("fork", forkSamples);
+    ctx.reportLatencies("zygote", zygoteSamples);
+    for (std::size_t k = 0; k < intervals; ++k)
+    {
+        std::string suffix = "_t" + std::to_string(k);
+        ctx.report("fork" + suffix + "_p50_us", percentile(forkByInterval[k], 0.5));
+        ctx.report("fork" + suffix + "_p99_us", percentile(forkByInterval[k], 0.99));
+        ctx.report("zygote" + suffix + "_p50_us", percentile(zygoteByInterval[k], 0.5));
+        ctx.report("zygote" + suffix + "_p99_us", percentile(zygoteByInterval[k], 0.99));
+    }
+}
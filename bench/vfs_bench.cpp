@@ -0,0 +1,189 @@
+// Бенчмарки VFS: задержка от создания каталога в ~/users до появления файлов пользователя
+// и сходимость множества «системных» пользователей после всплеска событий inotify
+
+#include "harness.h"
+
+#include "eventloop.h"
+#include "vfs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// События inotify обрабатывает EventLoop этого же потока — крутим его, пока ждём
+static bool waitForFile(const std::string &path, double timeoutSec)
+{
+    double deadline = Bench::now() + timeoutSec;
+    struct stat st{};
+    while (stat(path.c_str(), &st) != 0)
+    {
+        if (Bench::now() > deadline)
+            return false;
+        EventLoop::runOnce(1);
+    }
+    return true;
+}
+
+// Мониторинг запускается один раз на процесс, поэтому HOME и PATH подменяются
+// до VFS::initUsers() и не возвращаются; все случаи делят один каталог users.
+// Фиктивные adduser/deluser/usermod ведут «системных» пользователей в state.
+struct VfsFixture
+{
+    Bench::TempDir home;
+    std::string users;
+    std::string state;
+    bool ready = false;
+
+    VfsFixture()
+    {
+        users = home.path() + "/users";
+        state = home.path() + "/state";
+        setenv("HOME", home.path().c_str(), 1);
+        setenv("PATH", Bench::fakeUserToolsPath(home.path() + "/fakebin", state).c_str(), 1);
+        VFS::initUsers();
+        ready = waitForFile(users, 5.0);
+    }
+};
+
+static VfsFixture &fixture()
+{
+    static VfsFixture instance;
+    return instance;
+}
+
+static std::unordered_set<std::string> listNames(const std::string &dir, bool dirsOnly)
+{
+    std::unordered_set<std::string> names;
+    for (const auto &entry : std::filesystem::directory_iterator(dir))
+    {
+        if (!dirsOnly || entry.is_directory())
+            names.insert(entry.path().filename().string());
+    }
+    return names;
+}
+
+// Крутит EventLoop, пока пользователи в state не совпадут с каталогами в users.
+// Возвращает симметрическую разность на момент выхода: "+name" — каталог без
+// пользователя, "-name" — пользователь без каталога
+static std::vector<std::string> converge(const VfsFixture &fx, double timeoutSec)
+{
+    double deadline = Bench::now() + timeoutSec;
+    while (true)
+    {
+        // Окно склейки событий — десятки миллисекунд; сверяем реже, чем крутим цикл
+        for (int i = 0; i < 50; ++i)
+            EventLoop::runOnce(1);
+
+        auto dirs = listNames(fx.users, true);
+        auto users = listNames(fx.state, false);
+        std::vector<std::string> diff;
+        for (const auto &name : dirs)
+            if (!users.count(name))
+                diff.push_back("+" + name);
+        for (const auto &name : users)
+            if (!dirs.count(name))
+                diff.push_back("-" + name);
+        if (diff.empty() || Bench::now() > deadline)
+            return diff;
+    }
+}
+
+// Несошедшиеся имена — провал случая, первые из них попадают в сообщение
+static void failOnDiff(Bench::Context &ctx, const char *phase, std::vector<std::string> diff)
+{
+    if (diff.empty())
+        return;
+    std::sort(diff.begin(), diff.end());
+    std::string names;
+    for (std::size_t i = 0; i < diff.size() && i < 20; ++i)
+        names += " " + diff[i];
+    if (diff.size() > 20)
+        names += " ...";
+    ctx.fail(std::string("vfs_stress: ") + phase + ": " + std::to_string(diff.size()) +
+             " name(s) diverge between users dir and passwd:" + names);
+}
+
+KUBSH_BENCH(vfs_provision)
+{
+    VfsFixture &fx = fixture();
+    if (!fx.ready)
+    {
+        ctx.report("error", 1);
+        return;
+    }
+
+    std::size_t n = ctx.iterations(50);
+    std::vector<double> samples;
+    std::size_t lost = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        std::string dir = fx.users + "/bench" + std::to_string(i);
+        double begin = Bench::now();
+        mkdir(dir.c_str(), 0755);
+        if (waitForFile(dir + "/id", 5.0))
+            samples.push_back((Bench::now() - begin) * 1e6);
+        else
+            ++lost;
+    }
+    ctx.reportLatencies("provision", samples);
+    ctx.report("lost", static_cast<double>(lost));
+}
+
+// Всплеск: n каталогов создаются и 90% из них удаляются, не давая монитору
+// вклиниться (очередь inotify переполняется), затем каждый десятый из оставшихся переименовывается
+// небольшими порциями. После каждой фазы пользователи должны сойтись с каталогами.
+KUBSH_BENCH(vfs_stress)
+{
+    VfsFixture &fx = fixture();
+    if (!fx.ready)
+    {
+        ctx.fail("vfs_stress: users dir was not created");
+        return;
+    }
+
+    std::size_t n = ctx.iterations(50000);
+    std::string prefix = fx.users + "/stress";
+
+    double begin = Bench::now();
+    for (std::size_t i = 0; i < n; ++i)
+        mkdir((prefix + std::to_string(i)).c_str(), 0755);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (i % 10 != 0)
+            rmdir((prefix + std::to_string(i)).c_str());
+    }
+    double burst = Bench::now() - begin;
+
+    std::vector<std::string> burstDiff = converge(fx, 120.0);
+    double burstConverge = Bench::now() - begin;
+
+    // Переименования — порциями, чтобы пары MOVED_FROM/MOVED_TO дошли без переполнения
+    std::size_t renames = 0;
+    begin = Bench::now();
+    for (std::size_t i = 0; i < n; i += 100)
+    {
+        std::string from = prefix + std::to_string(i);
+        std::string to = fx.users + "/renamed" + std::to_string(i);
+        if (std::rename(from.c_str(), to.c_str()) == 0)
+            ++renames;
+        EventLoop::runOnce(0);
+    }
+    std::vector<std::string> renameDiff = converge(fx, 60.0);
+    double renameConverge = Bench::now() - begin;
+
+    ctx.report("dirs_created", static_cast<double>(n));
+    ctx.report("burst_events_per_sec", 2.0 * n / burst);
+    ctx.report("burst_converge_sec", burstConverge);
+    ctx.report("burst_mismatch", static_cast<double>(burstDiff.size()));
+    ctx.report("renames", static_cast<double>(renames));
+    ctx.report("rename_converge_sec", renameConverge);
+    ctx.report("rename_mismatch", static_cast<double>(renameDiff.size()));
+    failOnDiff(ctx, "after burst", burstDiff);
+    failOnDiff(ctx, "after renames", renameDiff);
+}
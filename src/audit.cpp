@@ -0,0 +1,1104 @@
+#include "audit.h"
+#include "config.h"
+#include "eventloop.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fcntl.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+namespace Audit
+{
+
+    // ===== format =====
+
+    // Файл: заголовок fileMagic (16 байт), затем блоки BlockHeader + данные.
+    // Данные блока — записи подряд, каждая с varint-длиной впереди, сжатые целиком.
+    // Индекс PATH.idx: indexMagic (16 байт), затем IndexEntry на каждый блок в порядке записи.
+    static constexpr char fileMagic[8] = {'K', 'U', 'B', 'A', 'U', 'D', 'T', '1'};
+    static constexpr char indexMagic[8] = {'K', 'U', 'B', 'A', 'I', 'D', 'X', '2'};
+    static constexpr std::size_t fileHeaderSize = 16;
+    static constexpr std::uint32_t blockMagic = 0x314b4241; // "ABK1"
+    static constexpr std::uint32_t mixedUid = 0xffffffff;
+    static constexpr std::size_t blockTarget = 64 * 1024; // столько несжатых данных копится в блоке
+    static constexpr int flushDelaySec = 2;               // и не дольше этого
+
+    enum BlockFlags : std::uint32_t
+    {
+        Compressed = 1,
+    };
+
+    enum RecordFlags : std::uint64_t
+    {
+        External = 1,
+        HasUsage = 2, // userUs/systemUs взяты из rusage потомка
+    };
+
+    struct BlockHeader
+    {
+        std::uint32_t magic;
+        std::uint32_t headerCrc; // CRC всех полей после этого
+        std::uint32_t rawSize;
+        std::uint32_t storedSize;
+        std::uint32_t count;
+        std::uint32_t flags;
+        std::int64_t firstNs; // минимальное и максимальное время начала команд в блоке
+        std::int64_t lastNs;
+        std::uint32_t uid; // mixedUid, если в блоке команды разных пользователей
+        std::uint32_t payloadCrc;
+        std::uint8_t statuses[32]; // битовая карта кодов завершения (status & 0xff)
+    };
+    static_assert(sizeof(BlockHeader) == 80, "BlockHeader is part of the file format");
+
+    struct IndexEntry
+    {
+        std::uint64_t offset;
+        std::uint64_t size; // заголовок и данные блока
+        std::int64_t firstNs;
+        std::int64_t lastNs;
+    };
+
+    struct Record
+    {
+        std::int64_t startNs = 0; // CLOCK_REALTIME
+        std::uint64_t durationNs = 0;
+        std::uint64_t uid = 0;
+        std::uint64_t pid = 0;      // kubsh, выполнивший команду
+        std::uint64_t childPid = 0; // 0 — встроенная команда
+        std::int64_t status = 0;
+        std::uint64_t flags = 0;
+        std::uint64_t userUs = 0; // процессорное время потомка
+        std::uint64_t systemUs = 0;
+        std::string cwd;
+        std::vector<std::string> argv;
+    };
+
+    static std::uint32_t crc32(const void *data, std::size_t size, std::uint32_t crc = 0)
+    {
+        static std::uint32_t table[256];
+        static bool ready = false;
+        if (!ready)
+        {
+            for (std::uint32_t i = 0; i < 256; ++i)
+            {
+                std::uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+            ready = true;
+        }
+
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static std::uint32_t headerCrc(const BlockHeader &header)
+    {
+        const char *begin = reinterpret_cast<const char *>(&header) + 8;
+        return crc32(begin, sizeof(header) - 8);
+    }
+
+    // ===== varint =====
+
+    static void putVarint(std::string &out, std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static void putSigned(std::string &out, std::int64_t value)
+    {
+        putVarint(out, (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+    }
+
+    static void putString(std::string &out, const std::string &s)
+    {
+        putVarint(out, s.size());
+        out.append(s);
+    }
+
+    struct Reader
+    {
+        const char *p;
+        const char *end;
+        bool ok = true;
+
+        std::uint64_t varint()
+        {
+            std::uint64_t value = 0;
+            for (int shift = 0; shift < 64 && p < end; shift += 7)
+            {
+                unsigned char c = static_cast<unsigned char>(*p++);
+                value |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+                if (!(c & 0x80))
+                    return value;
+            }
+            ok = false;
+            return 0;
+        }
+
+        std::int64_t signedVarint()
+        {
+            std::uint64_t v = varint();
+            return static_cast<std::int64_t>((v >> 1) ^ (~(v & 1) + 1));
+        }
+
+        std::string_view string()
+        {
+            std::uint64_t size = varint();
+            if (!ok || size > static_cast<std::uint64_t>(end - p))
+            {
+                ok = false;
+                return std::string_view();
+            }
+            std::string_view s(p, static_cast<std::size_t>(size));
+            p += size;
+            return s;
+        }
+    };
+
+    // Поля записи; prevNs — время предыдущей записи блока (время хранится разностью)
+    static void encode(const Record &r, std::int64_t prevNs, std::string &out)
+    {
+        std::string body;
+        putSigned(body, r.startNs - prevNs);
+        putVarint(body, r.durationNs);
+        putVarint(body, r.uid);
+        putVarint(body, r.pid);
+        putVarint(body, r.childPid);
+        putSigned(body, r.status);
+        putVarint(body, r.flags);
+        putVarint(body, r.userUs);
+        putVarint(body, r.systemUs);
+        putString(body, r.cwd);
+        putVarint(body, r.argv.size());
+        for (const auto &arg : r.argv)
+            putString(body, arg);
+
+        putVarint(out, body.size());
+        out.append(body);
+    }
+
+    // Читает запись; поля, добавленные позже, в конце тела пропускаются по длине
+    static bool decode(Reader &in, std::int64_t prevNs, Record &r)
+    {
+        std::uint64_t size = in.varint();
+        if (!in.ok || size > static_cast<std::uint64_t>(in.end - in.p))
+            return false;
+
+        Reader body{in.p, in.p + size};
+        in.p += size;
+
+        r.startNs = prevNs + body.signedVarint();
+        r.durationNs = body.varint();
+        r.uid = body.varint();
+        r.pid = body.varint();
+        r.childPid = body.varint();
+        r.status = body.signedVarint();
+        r.flags = body.varint();
+        r.userUs = body.varint();
+        r.systemUs = body.varint();
+        r.cwd = body.string();
+        std::uint64_t argc = body.varint();
+        if (!body.ok || argc > static_cast<std::uint64_t>(body.end - body.p))
+            return false;
+        r.argv.resize(static_cast<std::size_t>(argc));
+        for (auto &arg : r.argv)
+            arg = body.string();
+        return body.ok;
+    }
+
+    // ===== block codec =====
+
+    // Сжатие в духе LZ4: последовательности «литералы + совпадение», токен — две тетрады
+    // длин, смещение — 2 байта. zstd/lz4 в сборке не требуются.
+    static constexpr int hashBits = 14;
+    static constexpr std::size_t minMatch = 4;
+
+    static std::uint32_t read32(const char *p)
+    {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static void putLength(std::string &out, std::size_t length)
+    {
+        while (length >= 255)
+        {
+            out.push_back(static_cast<char>(255));
+            length -= 255;
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    static void emitSequence(std::string &out, const char *literals, std::size_t literalLength,
+                             std::size_t offset, std::size_t matchLength)
+    {
+        std::size_t lit = std::min<std::size_t>(literalLength, 15);
+        std::size_t match = matchLength ? std::min<std::size_t>(matchLength - minMatch, 15) : 0;
+        out.push_back(static_cast<char>((lit << 4) | match));
+        if (lit == 15)
+            putLength(out, literalLength - 15);
+        out.append(literals, literalLength);
+        if (!matchLength)
+            return; // последняя последовательность — только литералы
+
+        out.push_back(static_cast<char>(offset & 0xff));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (match == 15)
+            putLength(out, matchLength - minMatch - 15);
+    }
+
+    static std::string compress(const std::string &in)
+    {
+        std::string out;
+        out.reserve(in.size() / 2);
+        std::vector<std::uint32_t> table(1u << hashBits, 0); // позиция + 1
+
+        const char *src = in.data();
+        std::size_t n = in.size();
+        std::size_t anchor = 0;
+        std::size_t i = 0;
+        while (n >= 12 && i + minMatch <= n - 8)
+        {
+            std::uint32_t seq = read32(src + i);
+            std::uint32_t h = (seq * 2654435761u) >> (32 - hashBits);
+            std::size_t candidate = table[h];
+            table[h] = static_cast<std::uint32_t>(i + 1);
+
+            if (candidate && i - (candidate - 1) <= 0xffff && read32(src + candidate - 1) == seq)
+            {
+                std::size_t from = candidate - 1;
+                std::size_t length = minMatch;
+                while (i + length < n && src[from + length] == src[i + length])
+                    ++length;
+
+                emitSequence(out, src + anchor, i - anchor, i - from, length);
+                i += length;
+                anchor = i;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        emitSequence(out, src + anchor, n - anchor, 0, 0);
+        return out;
+    }
+
+    static bool decompress(const char *in, std::size_t size, std::size_t rawSize, std::string &out)
+    {
+        out.assign(rawSize, '\0');
+        const unsigned char *ip = reinterpret_cast<const unsigned char *>(in);
+        const unsigned char *end = ip + size;
+        std::size_t op = 0;
+
+        auto readLength = [&](std::size_t length) -> std::size_t
+        {
+            if (length != 15)
+                return length;
+            while (ip < end)
+            {
+                unsigned char c = *ip++;
+                length += c;
+                if (c != 255)
+                    return length;
+            }
+            return SIZE_MAX;
+        };
+
+        while (ip < end)
+        {
+            unsigned char token = *ip++;
+            std::size_t literals = readLength(token >> 4);
+            if (literals == SIZE_MAX || literals > static_cast<std::size_t>(end - ip) || literals > rawSize - op)
+                return false;
+            std::memcpy(&out[op], ip, literals);
+            ip += literals;
+            op += literals;
+            if (ip == end)
+                break;
+
+            if (end - ip < 2)
+                return false;
+            std::size_t offset = ip[0] | (static_cast<std::size_t>(ip[1]) << 8);
+            ip += 2;
+            std::size_t length = readLength(token & 0x0f);
+            if (length == SIZE_MAX || offset == 0 || offset > op)
+                return false;
+            length += minMatch;
+            if (length > rawSize - op)
+                return false;
+            for (std::size_t k = 0; k < length; ++k, ++op)
+                out[op] = out[op - offset]; // совпадение может перекрываться с собой
+        }
+        return op == rawSize;
+    }
+
+    // ===== writer =====
+
+    static Record current;
+    static bool active = false;
+    static std::chrono::steady_clock::time_point startedAt;
+
+    static std::string payload; // несжатые записи текущего блока
+    static BlockHeader pending{};
+    static std::int64_t prevNs = 0;
+
+    // Буфер и дескрипторы принадлежат процессу owner: fork-нутый потомок
+    // (сессия сервера) начинает с чистого листа, иначе записи родителя задвоились бы,
+    // а общий с родителем open file description сделал бы flock бесполезным
+    static pid_t owner = 0;
+    static int logFd = -1;
+    static int indexFd = -1;
+    static int timerFd = -1;
+    static bool timerArmed = false;
+    static std::string openPath;
+
+    static std::string logPath()
+    {
+        std::string path = Config::current()->auditLog;
+        if (!path.empty())
+            return path;
+        const char *home = std::getenv("HOME");
+        std::filesystem::path p(home ? home : ".");
+        p /= ".kubsh_audit";
+        return p.string();
+    }
+
+    static void resetBlock()
+    {
+        payload.clear();
+        pending = BlockHeader{};
+        pending.uid = static_cast<std::uint32_t>(getuid());
+        prevNs = 0;
+    }
+
+    static void ensureOwner()
+    {
+        if (owner == getpid())
+            return;
+        for (int *fd : {&logFd, &indexFd, &timerFd})
+        {
+            if (*fd != -1)
+                close(*fd);
+            *fd = -1;
+        }
+        timerArmed = false;
+        openPath.clear();
+        resetBlock();
+        owner = getpid();
+    }
+
+    static void armTimer()
+    {
+        if (timerArmed)
+            return;
+        if (timerFd == -1)
+        {
+            timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (timerFd == -1)
+                return;
+            EventLoop::watch(timerFd, [](unsigned)
+                             {
+                                 std::uint64_t expirations;
+                                 while (read(timerFd, &expirations, sizeof(expirations)) > 0)
+                                 {
+                                 }
+                                 timerArmed = false;
+                                 flush();
+                             });
+        }
+        struct itimerspec spec{};
+        spec.it_value.tv_sec = flushDelaySec;
+        timerArmed = timerfd_settime(timerFd, 0, &spec, nullptr) == 0;
+    }
+
+    void begin(const std::vector<std::string> &args)
+    {
+        active = Config::current()->audit;
+        if (!active)
+            return;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        startedAt = std::chrono::steady_clock::now();
+
+        current.startNs = static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        current.uid = getuid();
+        current.pid = static_cast<std::uint64_t>(getpid());
+        current.childPid = 0;
+        current.flags = 0;
+        current.userUs = 0;
+        current.systemUs = 0;
+        current.argv = args;
+
+        char cwd[4096];
+        current.cwd = getcwd(cwd, sizeof(cwd)) ? cwd : "";
+    }
+
+    void noteChild(pid_t pid, const struct rusage *usage)
+    {
+        if (!active)
+            return;
+        current.childPid = static_cast<std::uint64_t>(pid);
+        current.flags |= External;
+        if (usage)
+        {
+            current.flags |= HasUsage;
+            current.userUs = static_cast<std::uint64_t>(usage->ru_utime.tv_sec) * 1000000 + usage->ru_utime.tv_usec;
+            current.systemUs = static_cast<std::uint64_t>(usage->ru_stime.tv_sec) * 1000000 + usage->ru_stime.tv_usec;
+        }
+    }
+
+    void end(int status)
+    {
+        if (!active)
+            return;
+        active = false;
+        ensureOwner();
+
+        current.durationNs = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count());
+        current.status = status;
+
+        encode(current, prevNs, payload);
+        prevNs = current.startNs;
+
+        if (pending.count == 0 || current.startNs < pending.firstNs)
+            pending.firstNs = current.startNs;
+        if (pending.count == 0 || current.startNs > pending.lastNs)
+            pending.lastNs = current.startNs;
+        if (pending.uid != current.uid)
+            pending.uid = mixedUid;
+        unsigned code = static_cast<unsigned>(status) & 0xff;
+        pending.statuses[code / 8] |= static_cast<std::uint8_t>(1u << (code % 8));
+        ++pending.count;
+
+        if (payload.size() >= blockTarget)
+            flush();
+        else
+            armTimer();
+    }
+
+    static bool writeAll(int fd, const char *data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = write(fd, data, size);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    static bool openLog()
+    {
+        std::string path = logPath();
+        if (logFd != -1 && path == openPath)
+            return true;
+
+        if (logFd != -1)
+            close(logFd);
+        if (indexFd != -1)
+            close(indexFd);
+        logFd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        indexFd = open((path + ".idx").c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (logFd == -1)
+        {
+            std::perror(("kubsh: audit log " + path).c_str());
+            if (indexFd != -1)
+                close(indexFd);
+            indexFd = -1;
+            return false;
+        }
+        openPath = path;
+        return true;
+    }
+
+    // Заголовок пишется тем, кто первым увидел пустой файл (под flock)
+    static void writeMagic(int fd, const char (&magic)[8])
+    {
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size == 0)
+        {
+            char header[fileHeaderSize] = {};
+            std::memcpy(header, magic, sizeof(magic));
+            writeAll(fd, header, sizeof(header));
+        }
+    }
+
+    // Индекс прежнего формата пересоздаётся: он только ускоряет поиск,
+    // а блоки, которых в нём нет, читатель найдёт сканированием
+    static void resetStaleIndex(int fd)
+    {
+        char header[sizeof(indexMagic)];
+        if (pread(fd, header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+            std::memcmp(header, indexMagic, sizeof(indexMagic)) != 0)
+        {
+            if (ftruncate(fd, 0) == -1)
+                std::perror("kubsh: audit index");
+        }
+    }
+
+    void flush()
+    {
+        if (owner != getpid())
+        {
+            ensureOwner();
+            return;
+        }
+        if (payload.empty())
+            return;
+
+        if (timerArmed)
+        {
+            struct itimerspec off{};
+            timerfd_settime(timerFd, 0, &off, nullptr);
+            timerArmed = false;
+        }
+
+        if (!openLog())
+        {
+            resetBlock();
+            return;
+        }
+
+        std::string stored = compress(payload);
+        BlockHeader header = pending;
+        header.magic = blockMagic;
+        header.rawSize = static_cast<std::uint32_t>(payload.size());
+        if (stored.size() < payload.size())
+        {
+            header.flags |= Compressed;
+        }
+        else
+        {
+            stored = payload;
+        }
+        header.storedSize = static_cast<std::uint32_t>(stored.size());
+        header.payloadCrc = crc32(stored.data(), stored.size());
+        header.headerCrc = headerCrc(header);
+
+        // Блок целиком — один write(): оборванный хвост читатель опознает по CRC
+        // и найдёт следующий блок по магическому числу
+        std::string block(reinterpret_cast<const char *>(&header), sizeof(header));
+        block += stored;
+
+        flock(logFd, LOCK_EX);
+        writeMagic(logFd, fileMagic);
+        off_t offset = lseek(logFd, 0, SEEK_END);
+        bool written = writeAll(logFd, block.data(), block.size());
+        if (written && indexFd != -1)
+        {
+            resetStaleIndex(indexFd);
+            writeMagic(indexFd, indexMagic);
+            IndexEntry entry{static_cast<std::uint64_t>(offset), block.size(), header.firstNs, header.lastNs};
+            writeAll(indexFd, reinterpret_cast<const char *>(&entry), sizeof(entry));
+        }
+        flock(logFd, LOCK_UN);
+
+        if (!written)
+            std::perror("kubsh: audit log write failed");
+        resetBlock();
+    }
+
+    // ===== query =====
+
+    struct Filter
+    {
+        std::int64_t sinceNs = INT64_MIN;
+        std::int64_t untilNs = INT64_MAX;
+        bool byUser = false;
+        std::uint32_t uid = 0;
+        enum class Status
+        {
+            Any,
+            Ok,
+            Failed,
+            Code,
+        } status = Status::Any;
+        int code = 0;
+        std::size_t limit = 0; // 0 — все; иначе последние limit записей
+
+        bool blockMayMatch(const BlockHeader &h) const
+        {
+            if (h.lastNs < sinceNs || h.firstNs > untilNs)
+                return false;
+            if (byUser && h.uid != mixedUid && h.uid != uid)
+                return false;
+
+            auto has = [&](unsigned c)
+            { return (h.statuses[c / 8] >> (c % 8)) & 1; };
+            switch (status)
+            {
+            case Status::Ok:
+                return has(0);
+            case Status::Code:
+                return has(static_cast<unsigned>(code) & 0xff);
+            case Status::Failed:
+                for (unsigned c = 1; c < 256; ++c)
+                    if (has(c))
+                        return true;
+                return false;
+            default:
+                return true;
+            }
+        }
+
+        bool matches(const Record &r) const
+        {
+            if (r.startNs < sinceNs || r.startNs > untilNs)
+                return false;
+            if (byUser && r.uid != uid)
+                return false;
+            switch (status)
+            {
+            case Status::Ok:
+                return r.status == 0;
+            case Status::Failed:
+                return r.status != 0;
+            case Status::Code:
+                return r.status == code;
+            default:
+                return true;
+            }
+        }
+    };
+
+    // @EPOCH, YYYY-MM-DD[ HH:MM[:SS]] (местное время) или -30s/-15m/-2h/-3d от текущего момента
+    static bool parseTime(const std::string &text, std::int64_t &ns)
+    {
+        if (text.empty())
+            return false;
+
+        char *end = nullptr;
+        if (text[0] == '@')
+        {
+            long long sec = std::strtoll(text.c_str() + 1, &end, 10);
+            if (*end)
+                return false;
+            ns = sec * 1000000000LL;
+            return true;
+        }
+        if (text[0] == '-')
+        {
+            long long n = std::strtoll(text.c_str() + 1, &end, 10);
+            long long unit = 0;
+            if (std::strcmp(end, "s") == 0)
+                unit = 1;
+            else if (std::strcmp(end, "m") == 0)
+                unit = 60;
+            else if (std::strcmp(end, "h") == 0)
+                unit = 3600;
+            else if (std::strcmp(end, "d") == 0)
+                unit = 86400;
+            else
+                return false;
+            ns = (static_cast<long long>(std::time(nullptr)) - n * unit) * 1000000000LL;
+            return true;
+        }
+
+        for (const char *format : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"})
+        {
+            struct tm tm{};
+            const char *rest = strptime(text.c_str(), format, &tm);
+            if (rest && *rest == '\0')
+            {
+                tm.tm_isdst = -1;
+                ns = static_cast<std::int64_t>(mktime(&tm)) * 1000000000LL;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static std::string formatTime(std::int64_t ns)
+    {
+        time_t sec = static_cast<time_t>(ns / 1000000000);
+        struct tm tm{};
+        localtime_r(&sec, &tm);
+        char buf[64];
+        std::size_t len = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        std::snprintf(buf + len, sizeof(buf) - len, ".%03d", static_cast<int>((ns / 1000000) % 1000));
+        return buf;
+    }
+
+    static std::string joinArgs(const std::vector<std::string> &argv)
+    {
+        std::string line;
+        for (const auto &arg : argv)
+        {
+            if (!line.empty())
+                line.push_back(' ');
+            bool quote = arg.empty() || arg.find_first_of(" \t;&|") != std::string::npos;
+            line += quote ? '"' + arg + '"' : arg;
+        }
+        return line;
+    }
+
+    struct Block
+    {
+        std::size_t offset;
+        BlockHeader header;
+        bool verified; // CRC данных уже проверен при сканировании
+    };
+
+    // Записи индекса, которым можно верить: в пределах файла и без перекрытий.
+    // Идём с конца: если журнал обрезали и дописали, новая запись индекса перекрывает
+    // старую, и верить надо новой — она описывает файл, каким он стал
+    static std::vector<IndexEntry> readIndex(const std::string &indexPath, std::size_t fileSize)
+    {
+        std::vector<IndexEntry> entries;
+        int fd = open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return entries;
+
+        struct stat st{};
+        std::vector<char> index;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(fileHeaderSize))
+        {
+            index.resize(static_cast<std::size_t>(st.st_size));
+            if (pread(fd, index.data(), index.size(), 0) != static_cast<ssize_t>(index.size()) ||
+                std::memcmp(index.data(), indexMagic, sizeof(indexMagic)) != 0)
+            {
+                index.clear();
+            }
+        }
+        close(fd);
+
+        std::size_t count = index.empty() ? 0 : (index.size() - fileHeaderSize) / sizeof(IndexEntry);
+        std::uint64_t limit = fileSize;
+        for (std::size_t i = count; i-- > 0;)
+        {
+            IndexEntry entry;
+            std::memcpy(&entry, index.data() + fileHeaderSize + i * sizeof(entry), sizeof(entry));
+            if (entry.offset < fileHeaderSize || entry.size < sizeof(BlockHeader) ||
+                entry.offset > limit || entry.size > limit - entry.offset)
+                continue;
+            entries.push_back(entry);
+            limit = entry.offset;
+        }
+        std::reverse(entries.begin(), entries.end());
+        return entries;
+    }
+
+    // Блоки журнала, в которых могут быть записи из [sinceNs, untilNs]. Участки, описанные
+    // индексом, берутся из него, и блоки вне интервала не читаются вовсе; остальное
+    // (падение между записью блока и индекса, оборванный хвост, нет индекса) сканируется
+    // по заголовкам. damaged — сколько найденных сканированием блоков не сошлись по CRC
+    static std::vector<Block> findBlocks(const char *data, std::size_t size, const std::string &indexPath,
+                                         std::int64_t sinceNs, std::int64_t untilNs, std::size_t &damaged)
+    {
+        std::vector<Block> blocks;
+
+        // Заголовок блока, целиком лежащего до limit
+        auto headerAt = [&](std::size_t offset, std::size_t limit, BlockHeader &h)
+        {
+            if (offset + sizeof(h) > limit)
+                return false;
+            std::memcpy(&h, data + offset, sizeof(h));
+            return h.magic == blockMagic && h.headerCrc == headerCrc(h) &&
+                   h.storedSize <= limit - offset - sizeof(h);
+        };
+
+        // Размеру из заголовка без проверки данных верить нельзя: у оборванного блока
+        // он может указывать за начало следующего. Поэтому блок принимается только
+        // вместе с CRC данных, иначе ищем магическое число со следующего байта
+        auto scan = [&](std::size_t from, std::size_t to)
+        {
+            std::uint32_t magic = blockMagic;
+            while (from + sizeof(BlockHeader) <= to)
+            {
+                BlockHeader h;
+                if (headerAt(from, to, h))
+                {
+                    if (crc32(data + from + sizeof(h), h.storedSize) == h.payloadCrc)
+                    {
+                        blocks.push_back(Block{from, h, true});
+                        from += sizeof(h) + h.storedSize;
+                        continue;
+                    }
+                    ++damaged;
+                }
+                const void *next = memmem(data + from + 1, to - from - 1, &magic, sizeof(magic));
+                if (!next)
+                    break;
+                from = static_cast<std::size_t>(static_cast<const char *>(next) - data);
+            }
+        };
+
+        std::size_t pos = size >= fileHeaderSize && std::memcmp(data, fileMagic, sizeof(fileMagic)) == 0
+                              ? fileHeaderSize
+                              : 0;
+
+        // Блоки разных процессов перемежаются, поэтому время в индексе растёт лишь
+        // в среднем. Монотонны максимум lastNs по префиксу и минимум firstNs по суффиксу:
+        // по ним двоичным поиском находятся записи, которые могут пересечься с интервалом
+        std::vector<IndexEntry> entries = readIndex(indexPath, size);
+        std::vector<std::int64_t> maxLast(entries.size());
+        std::vector<std::int64_t> minFirst(entries.size());
+        for (std::size_t i = 0; i < entries.size(); ++i)
+            maxLast[i] = i ? std::max(maxLast[i - 1], entries[i].lastNs) : entries[i].lastNs;
+        for (std::size_t i = entries.size(); i-- > 0;)
+            minFirst[i] = i + 1 < entries.size() ? std::min(minFirst[i + 1], entries[i].firstNs) : entries[i].firstNs;
+        std::size_t lo = static_cast<std::size_t>(
+            std::lower_bound(maxLast.begin(), maxLast.end(), sinceNs) - maxLast.begin());
+        std::size_t hi = static_cast<std::size_t>(
+            std::upper_bound(minFirst.begin(), minFirst.end(), untilNs) - minFirst.begin());
+
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            const IndexEntry &entry = entries[i];
+            if (entry.offset < pos)
+                continue;
+            if (entry.offset > pos)
+                scan(pos, entry.offset);
+            std::size_t end = entry.offset + entry.size;
+            pos = end;
+            if (i < lo || i >= hi)
+                continue;
+
+            BlockHeader h;
+            if (headerAt(entry.offset, end, h) && sizeof(h) + h.storedSize == entry.size)
+                blocks.push_back(Block{entry.offset, h, false});
+            else
+                scan(entry.offset, end); // индекс не сходится с файлом
+        }
+        scan(pos, size);
+        return blocks;
+    }
+
+    int query(const std::vector<std::string> &args, bool replay)
+    {
+        Filter filter;
+        std::string path;
+        for (std::size_t i = 0; i < args.size(); ++i)
+        {
+            const std::string &opt = args[i];
+            static const char *const options[] = {"--log", "--since", "--until", "--user", "--status", "--limit"};
+            if (std::find(std::begin(options), std::end(options), opt) == std::end(options))
+            {
+                std::cerr << "kubsh: unknown option: " << opt << std::endl;
+                return 2;
+            }
+            if (i + 1 >= args.size())
+            {
+                std::cerr << "kubsh: " << opt << " requires a value" << std::endl;
+                return 2;
+            }
+            const std::string &value = args[++i];
+
+            if (opt == "--log")
+            {
+                path = value;
+            }
+            else if (opt == "--since" || opt == "--until")
+            {
+                if (!parseTime(value, opt == "--since" ? filter.sinceNs : filter.untilNs))
+                {
+                    std::cerr << "kubsh: invalid time: " << value << std::endl;
+                    return 2;
+                }
+            }
+            else if (opt == "--user")
+            {
+                filter.byUser = true;
+                struct passwd *pwd = getpwnam(value.c_str());
+                if (pwd)
+                {
+                    filter.uid = pwd->pw_uid;
+                }
+                else
+                {
+                    char *end = nullptr;
+                    unsigned long uid = std::strtoul(value.c_str(), &end, 10);
+                    if (value.empty() || *end)
+                    {
+                        std::cerr << "kubsh: unknown user: " << value << std::endl;
+                        return 2;
+                    }
+                    filter.uid = static_cast<std::uint32_t>(uid);
+                }
+            }
+            else if (opt == "--status")
+            {
+                if (value == "ok")
+                {
+                    filter.status = Filter::Status::Ok;
+                }
+                else if (value == "failed")
+                {
+                    filter.status = Filter::Status::Failed;
+                }
+                else
+                {
+                    char *end = nullptr;
+                    long code = std::strtol(value.c_str(), &end, 10);
+                    if (value.empty() || *end)
+                    {
+                        std::cerr << "kubsh: invalid status: " << value << " (expected N, ok or failed)" << std::endl;
+                        return 2;
+                    }
+                    filter.status = Filter::Status::Code;
+                    filter.code = static_cast<int>(code);
+                }
+            }
+            else if (opt == "--limit")
+            {
+                // strtoull молча принимает "-1" и мусор — проверяем строку сами
+                char *end = nullptr;
+                unsigned long long limit = std::strtoull(value.c_str(), &end, 10);
+                if (value.empty() || value[0] == '-' || value[0] == '+' || *end)
+                {
+                    std::cerr << "kubsh: invalid limit: " << value << std::endl;
+                    return 2;
+                }
+                filter.limit = static_cast<std::size_t>(limit);
+            }
+        }
+        if (path.empty())
+            path = logPath();
+
+        // Свои ещё не записанные команды тоже должны попасть в выборку
+        flush();
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            std::perror(("kubsh: " + path).c_str());
+            return 1;
+        }
+        struct stat st{};
+        fstat(fd, &st);
+        std::size_t size = static_cast<std::size_t>(st.st_size);
+        void *map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            std::perror("kubsh: mmap");
+            return 1;
+        }
+        const char *data = static_cast<const char *>(map);
+
+        auto byStart = [](const Record &a, const Record &b)
+        { return a.startNs < b.startNs; };
+        std::vector<Record> matches;
+        std::size_t damaged = 0;
+        std::string raw;
+        for (const Block &block : findBlocks(data, size, path + ".idx", filter.sinceNs, filter.untilNs, damaged))
+        {
+            const BlockHeader &h = block.header;
+            if (!filter.blockMayMatch(h))
+                continue;
+
+            const char *stored = data + block.offset + sizeof(h);
+            if (!block.verified && crc32(stored, h.storedSize) != h.payloadCrc)
+            {
+                ++damaged;
+                continue;
+            }
+            if (h.flags & Compressed)
+            {
+                if (!decompress(stored, h.storedSize, h.rawSize, raw))
+                {
+                    ++damaged;
+                    continue;
+                }
+            }
+            else
+            {
+                raw.assign(stored, h.storedSize);
+            }
+
+            Reader in{raw.data(), raw.data() + raw.size()};
+            std::int64_t prev = 0;
+            Record r;
+            for (std::uint32_t k = 0; k < h.count && decode(in, prev, r); ++k)
+            {
+                prev = r.startNs;
+                if (filter.matches(r))
+                    matches.push_back(std::move(r));
+            }
+
+            // С --limit нужны только последние записи: не держим в памяти весь журнал
+            if (filter.limit && matches.size() >= 2 * filter.limit + 4096)
+            {
+                std::stable_sort(matches.begin(), matches.end(), byStart);
+                matches.erase(matches.begin(), matches.end() - static_cast<std::ptrdiff_t>(filter.limit));
+            }
+        }
+        if (map)
+            munmap(map, size);
+
+        // Блоки разных процессов перемежаются — упорядочиваем по времени начала
+        std::stable_sort(matches.begin(), matches.end(), byStart);
+        std::size_t first = filter.limit && matches.size() > filter.limit ? matches.size() - filter.limit : 0;
+
+        std::string lastCwd;
+        for (std::size_t i = first; i < matches.size(); ++i)
+        {
+            const Record &r = matches[i];
+            if (replay)
+            {
+                std::cout << "# " << formatTime(r.startNs) << " pid=" << r.pid << " status=" << r.status << "\n";
+                if (r.cwd != lastCwd && !r.cwd.empty())
+                {
+                    std::cout << "cd " << joinArgs({r.cwd}) << "\n";
+                    lastCwd = r.cwd;
+                }
+                std::cout << joinArgs(r.argv) << "\n";
+                continue;
+            }
+
+            char timing[64];
+            std::snprintf(timing, sizeof(timing), "%.3fms", static_cast<double>(r.durationNs) / 1e6);
+            std::cout << formatTime(r.startNs) << " uid=" << r.uid << " pid=" << r.pid;
+            if (r.childPid)
+                std::cout << " child=" << r.childPid;
+            std::cout << " status=" << r.status << " time=" << timing;
+            if (r.flags & HasUsage)
+            {
+                std::snprintf(timing, sizeof(timing), " cpu=%.3fs", static_cast<double>(r.userUs + r.systemUs) / 1e6);
+                std::cout << timing;
+            }
+            std::cout << " cwd=" << r.cwd << "  " << joinArgs(r.argv) << "\n";
+        }
+        std::cout.flush();
+
+        if (damaged)
+            std::cerr << "kubsh: " << damaged << " damaged block(s) skipped" << std::endl;
+        return 0;
+    }
+
+}
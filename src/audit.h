@@ -0,0 +1,37 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+struct rusage;
+
+namespace Audit
+{
+    // Журнал аудита (~/.kubsh_audit, ключи audit и audit_log в ~/.kubshrc).
+    // Каждая команда — запись с argv, cwd, кодом завершения и временем; записи копятся
+    // в памяти и уходят на диск сжатыми блоками с CRC одним write() под flock,
+    // так что параллельные kubsh и падение посреди записи не портят уже записанное.
+    // Рядом, в PATH.idx, — разреженный индекс: смещение, размер и интервал времени блока.
+
+    // Начало команды из Script; время отсчитывается отсюда
+    void begin(const std::vector<std::string> &args);
+
+    // Для внешних команд: pid и, если есть, rusage завершившегося потомка
+    void noteChild(pid_t pid, const struct rusage *usage);
+
+    // Конец команды: запись попадает в текущий блок
+    void end(int status);
+
+    // Дописывает накопленный блок; вызывается перед выходом
+    void flush();
+
+    // kubsh --query/--replay [--log PATH] [--since T] [--until T] [--user U] [--status S] [--limit N]:
+    // печатает подходящие записи (replay — как сценарий для kubsh). Блоки вне --since/--until
+    // отсекаются двоичным поиском по индексу, не проходящие остальные фильтры по заголовку
+    // не распаковываются.
+    int query(const std::vector<std::string> &args, bool replay);
+}
+
+#endif // AUDIT_H
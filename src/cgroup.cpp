@@ -0,0 +1,590 @@
+#include "cgroup.h"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <set>
+#include <vector>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+namespace Cgroup
+{
+
+    // ===== limits =====
+
+    static constexpr long long cpuPeriod = 100000; // мкс, как по умолчанию в ядре
+
+    // 4G, 512M, 100K или просто байты; "max" — без ограничения
+    static bool parseBytes(const std::string &value, std::string &out)
+    {
+        if (value == "max")
+        {
+            out = value;
+            return true;
+        }
+        try
+        {
+            std::size_t pos = 0;
+            double n = std::stod(value, &pos);
+            unsigned long long scale = 1;
+            if (pos + 1 == value.size())
+            {
+                switch (value[pos])
+                {
+                case 'K':
+                case 'k':
+                    scale = 1ull << 10;
+                    break;
+                case 'M':
+                case 'm':
+                    scale = 1ull << 20;
+                    break;
+                case 'G':
+                case 'g':
+                    scale = 1ull << 30;
+                    break;
+                case 'T':
+                case 't':
+                    scale = 1ull << 40;
+                    break;
+                default:
+                    return false;
+                }
+            }
+            else if (pos != value.size())
+            {
+                return false;
+            }
+            if (!(n > 0))
+            {
+                return false;
+            }
+            out = std::to_string(static_cast<unsigned long long>(std::llround(n * static_cast<double>(scale))));
+            return true;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    // Число CPU (можно дробное: 0.5) → "квота период" для cpu.max
+    static bool parseCpu(const std::string &value, std::string &out)
+    {
+        if (value == "max")
+        {
+            out = "max " + std::to_string(cpuPeriod);
+            return true;
+        }
+        try
+        {
+            std::size_t pos = 0;
+            double n = std::stod(value, &pos);
+            if (pos != value.size() || !(n > 0))
+            {
+                return false;
+            }
+            long long quota = std::max(1000LL, std::llround(n * cpuPeriod));
+            out = std::to_string(quota) + " " + std::to_string(cpuPeriod);
+            return true;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    bool parseLimit(const std::string &option, Limits &limits, std::string &error)
+    {
+        std::size_t eq = option.find('=');
+        std::string key = option.substr(0, eq);
+        std::string value = eq == std::string::npos ? std::string() : option.substr(eq + 1);
+
+        bool ok = false;
+        if (key == "cpu")
+            ok = parseCpu(value, limits.cpuMax);
+        else if (key == "mem")
+            ok = parseBytes(value, limits.memoryMax);
+        else if (key == "io")
+            ok = parseBytes(value, limits.ioBps);
+        else
+        {
+            error = "unknown limit: " + key + " (expected cpu=, mem= or io=)";
+            return false;
+        }
+
+        if (!ok)
+        {
+            error = "invalid " + key + " limit: " + value;
+        }
+        return ok;
+    }
+
+    bool parseLimits(const std::string &text, Limits &limits, std::string &error)
+    {
+        std::istringstream in(text);
+        std::string option;
+        while (in >> option)
+        {
+            if (!parseLimit(option, limits, error))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // ===== files =====
+
+    static bool writeFile(const std::string &path, const std::string &value)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+        ssize_t n = write(fd, value.data(), value.size());
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return n == static_cast<ssize_t>(value.size());
+    }
+
+    static std::string readFile(const std::string &path)
+    {
+        std::ifstream in(path);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+
+    // Число в начале text (после него — пробел, перевод строки или конец).
+    // Содержимое файлов cgroup бывает пустым или неожиданным — тогда false, а не исключение
+    static bool parseNumber(const std::string &text, double &value)
+    {
+        const char *begin = text.c_str();
+        char *end = nullptr;
+        errno = 0;
+        value = std::strtod(begin, &end);
+        return end != begin && errno == 0 && (*end == '\0' || std::isspace(static_cast<unsigned char>(*end)));
+    }
+
+    // ===== delegated subtree =====
+
+    static bool prepared = false;
+    static bool usable = false;
+    static std::string base; // cgroup kubsh; временные cgroup команд создаются в ней
+    static unsigned counter = 0;
+    static std::set<std::string> warned;
+    static std::string leaf;                // kubsh-PID, куда kubsh перенёс себя (пусто — не переносил)
+    static pid_t leafOwner = 0;             // процесс, создавший leaf; потомки его не трогают
+    static std::vector<std::string> enabled; // контроллеры, включённые в base этим kubsh
+
+    static void warnOnce(const std::string &key, const std::string &message)
+    {
+        if (warned.insert(key).second)
+        {
+            std::cerr << "kubsh: " << message << std::endl;
+        }
+    }
+
+    // Точка монтирования cgroup2 из /proc/self/mountinfo
+    static std::string findMount()
+    {
+        std::ifstream in("/proc/self/mountinfo");
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::size_t sep = line.find(" - ");
+            if (sep == std::string::npos || line.compare(sep + 3, 8, "cgroup2 ") != 0)
+                continue;
+
+            std::istringstream fields(line.substr(0, sep));
+            std::string id, parent, dev, root, mountPoint;
+            fields >> id >> parent >> dev >> root >> mountPoint;
+            return mountPoint;
+        }
+        return std::string();
+    }
+
+    // Путь своей cgroup v2 из строки "0::/path" в /proc/self/cgroup
+    static std::string ownCgroup()
+    {
+        std::ifstream in("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.compare(0, 3, "0::") == 0)
+                return line.substr(3);
+        }
+        return std::string();
+    }
+
+    static pid_t parentOf(pid_t pid)
+    {
+        std::string stat = readFile("/proc/" + std::to_string(pid) + "/stat");
+        std::size_t paren = stat.rfind(')');
+        if (paren == std::string::npos)
+            return 0;
+        std::istringstream fields(stat.substr(paren + 1));
+        std::string state;
+        pid_t ppid = 0;
+        fields >> state >> ppid;
+        return ppid;
+    }
+
+    // Переносит kubsh и его потомков (например, помощника запуска) из from в to.
+    // В лист: контроллеры можно раздать дочерним cgroup, только если в самой base процессов нет
+    static void moveOurs(const std::string &from, const std::string &to)
+    {
+        pid_t self = getpid();
+        std::istringstream procs(readFile(from + "/cgroup.procs"));
+        pid_t pid;
+        while (procs >> pid)
+        {
+            if (pid == self || parentOf(pid) == self)
+            {
+                writeFile(to + "/cgroup.procs", std::to_string(pid));
+            }
+        }
+    }
+
+    // Пустые kubsh-PID и kubsh-PID-N, оставшиеся от завершившихся kubsh
+    // (упавших или уходивших, пока рядом работали другие)
+    static void sweepStale()
+    {
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(base, ec))
+        {
+            std::string name = entry.path().filename().string();
+            if (name.compare(0, 6, "kubsh-") != 0 || !entry.is_directory(ec))
+                continue;
+            pid_t pid = static_cast<pid_t>(std::strtol(name.c_str() + 6, nullptr, 10));
+            if (pid > 0 && kill(pid, 0) == -1 && errno == ESRCH)
+                rmdir(entry.path().c_str()); // занятую cgroup ядро не удалит
+        }
+    }
+
+    // Возвращает kubsh из листа в base и удаляет лист. Пока в base есть другие cgroup
+    // (соседние kubsh), контроллеры выключать нельзя, а без этого процесс в base не вернуть —
+    // тогда лист остаётся и его уберёт sweepStale() следующего kubsh
+    static void releaseLeaf()
+    {
+        if (leaf.empty() || leafOwner != getpid())
+            return;
+
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(base, ec))
+        {
+            if (entry.is_directory(ec) && entry.path().string() != leaf)
+                return;
+        }
+        for (auto it = enabled.rbegin(); it != enabled.rend(); ++it)
+        {
+            writeFile(base + "/cgroup.subtree_control", "-" + *it);
+        }
+        moveOurs(leaf, base);
+        if (rmdir(leaf.c_str()) == 0)
+            leaf.clear();
+    }
+
+    static void enableControllers()
+    {
+        // Включённые до нас выключать при выходе не нам
+        std::istringstream current(readFile(base + "/cgroup.subtree_control"));
+        std::set<std::string> alreadyOn{std::istream_iterator<std::string>(current), std::istream_iterator<std::string>()};
+
+        std::istringstream available(readFile(base + "/cgroup.controllers"));
+        std::string name;
+        while (available >> name)
+        {
+            if ((name == "cpu" || name == "memory" || name == "io") && !alreadyOn.count(name) &&
+                writeFile(base + "/cgroup.subtree_control", "+" + name))
+            {
+                enabled.push_back(name);
+            }
+        }
+    }
+
+    static bool prepare()
+    {
+        if (prepared)
+            return usable;
+        prepared = true;
+
+        std::string mount = findMount();
+        std::string own = ownCgroup();
+        if (mount.empty() || own.empty())
+        {
+            std::cerr << "kubsh: cgroup v2 is not available; limits are disabled" << std::endl;
+            return false;
+        }
+
+        base = own == "/" ? mount : mount + own;
+        if (access(base.c_str(), W_OK) != 0 || access((base + "/cgroup.procs").c_str(), W_OK) != 0)
+        {
+            std::cerr << "kubsh: no delegated cgroup v2 subtree at " << base << "; limits are disabled" << std::endl;
+            return false;
+        }
+
+        sweepStale();
+
+        // В корневой cgroup процессы не мешают раздаче контроллеров, лист не нужен
+        if (own != "/")
+        {
+            std::string path = base + "/kubsh-" + std::to_string(getpid());
+            if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST)
+            {
+                std::cerr << "kubsh: cannot create " << path << ": " << std::strerror(errno)
+                          << "; limits are disabled" << std::endl;
+                return false;
+            }
+            leaf = path;
+            leafOwner = getpid();
+            std::atexit(releaseLeaf);
+            moveOurs(base, leaf);
+        }
+        enableControllers();
+
+        usable = true;
+        return true;
+    }
+
+    // Блочное устройство (диск целиком, "MAJ:MIN") под текущим каталогом — для io.max
+    static std::string blockDevice()
+    {
+        struct stat st{};
+        if (stat(".", &st) == -1)
+            return std::string();
+
+        std::string dev = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+        std::string sys = "/sys/dev/block/" + dev;
+        std::error_code ec;
+        if (!std::filesystem::exists(sys, ec))
+            return std::string(); // overlayfs, tmpfs и т.п.
+
+        // io.max принимает только диск, не раздел
+        if (std::filesystem::exists(sys + "/partition", ec))
+        {
+            std::filesystem::path disk = std::filesystem::canonical(sys, ec).parent_path();
+            std::string parent = readFile((disk / "dev").string());
+            while (!parent.empty() && (parent.back() == '\n' || parent.back() == ' '))
+                parent.pop_back();
+            return parent;
+        }
+        return dev;
+    }
+
+    // ===== scopes =====
+
+    static void apply(const std::string &path, const char *controller, const char *file, const std::string &value)
+    {
+        if (!writeFile(path + "/" + file, value))
+        {
+            warnOnce(controller, std::string(file) + " is not enforced: " + std::strerror(errno) +
+                                     " (is the " + controller + " controller enabled in " + base + "?)");
+        }
+    }
+
+    bool create(const Limits &limits, Scope &scope)
+    {
+        if (!prepare())
+            return false;
+
+        // path заполняется только для созданной cgroup: finish() читает и удаляет её
+        std::string path = base + "/kubsh-" + std::to_string(getpid()) + "-" + std::to_string(++counter);
+        if (mkdir(path.c_str(), 0755) == -1)
+        {
+            std::cerr << "kubsh: cannot create " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        scope.path = path;
+
+        if (!limits.cpuMax.empty())
+            apply(scope.path, "cpu", "cpu.max", limits.cpuMax);
+        if (!limits.memoryMax.empty())
+            apply(scope.path, "memory", "memory.max", limits.memoryMax);
+        if (!limits.ioBps.empty())
+        {
+            std::string dev = blockDevice();
+            if (dev.empty())
+                warnOnce("io-device", "io limit is not enforced: no block device behind the current directory");
+            else
+                apply(scope.path, "io", "io.max", dev + " rbps=" + limits.ioBps + " wbps=" + limits.ioBps);
+        }
+
+        scope.fd = open(scope.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (scope.fd == -1)
+        {
+            std::perror("kubsh: open cgroup");
+            rmdir(scope.path.c_str());
+            scope.path.clear();
+            return false;
+        }
+        return true;
+    }
+
+    pid_t spawn(const Scope &scope)
+    {
+#ifdef SYS_clone3
+        // Потомок до exec делает только async-signal-safe вызовы (argv готовит
+        // родитель), так что обход atfork-обработчиков glibc ему не мешает
+        struct clone_args args{};
+        args.flags = CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = static_cast<std::uint64_t>(scope.fd);
+        pid_t pid = static_cast<pid_t>(syscall(SYS_clone3, &args, sizeof(args)));
+        if (pid != -1)
+        {
+            return pid;
+        }
+#endif
+        // clone3 не смог (старое ядро без CLONE_INTO_CGROUP, EBUSY/EOPNOTSUPP от самой
+        // cgroup и т.п.): потомок переносит себя сам, ещё до exec, и только
+        // async-signal-safe вызовами — путь к cgroup.procs берётся от scope.fd.
+        // Если и это не удалось, команда не запускается без обещанных ограничений
+        pid_t child = fork();
+        if (child == 0)
+        {
+            int fd = openat(scope.fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+            if (fd == -1 || write(fd, "0", 1) != 1)
+            {
+                const char *reason = strerrordesc_np(errno);
+                const char *parts[] = {"kubsh: cannot join cgroup: ", reason ? reason : "error", "\n"};
+                for (const char *part : parts)
+                {
+                    ssize_t ignored = write(STDERR_FILENO, part, std::strlen(part));
+                    (void)ignored;
+                }
+                _exit(126);
+            }
+            close(fd);
+        }
+        return child;
+    }
+
+    // "some ... total=N" из файла PSI; total — суммарное время задержки в мкс
+    static bool pressureTotal(const std::string &text, const char *kind, double &ms)
+    {
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            if (line.compare(0, std::strlen(kind), kind) != 0)
+                continue;
+            std::size_t pos = line.find("total=");
+            double us = 0;
+            if (pos == std::string::npos || !parseNumber(line.substr(pos + 6), us))
+                return false;
+            ms = us / 1000.0;
+            return true;
+        }
+        return false;
+    }
+
+    static std::string human(double bytes)
+    {
+        const char *units[] = {"B", "K", "M", "G", "T"};
+        int unit = 0;
+        while (bytes >= 1024 && unit < 4)
+        {
+            bytes /= 1024;
+            ++unit;
+        }
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.1f%s", bytes, units[unit]);
+        return buf;
+    }
+
+    void finish(Scope &scope)
+    {
+        if (scope.fd != -1)
+        {
+            close(scope.fd);
+            scope.fd = -1;
+        }
+        if (scope.path.empty())
+            return;
+
+        std::ostringstream report;
+        char buf[64];
+
+        double peak = 0;
+        if (parseNumber(readFile(scope.path + "/memory.peak"), peak))
+            report << " memory.peak " << human(peak);
+
+        std::string cpuStat = readFile(scope.path + "/cpu.stat");
+        std::size_t usage = cpuStat.find("usage_usec ");
+        double usageUs = 0;
+        if (usage != std::string::npos && parseNumber(cpuStat.substr(usage + 11), usageUs))
+        {
+            std::snprintf(buf, sizeof(buf), "%.2fs", usageUs / 1e6);
+            report << " cpu " << buf;
+        }
+
+        double some = 0, full = 0;
+        if (pressureTotal(readFile(scope.path + "/cpu.pressure"), "some", some))
+        {
+            std::snprintf(buf, sizeof(buf), "%.1fms", some);
+            report << " cpu.pressure some " << buf;
+        }
+        std::string io = readFile(scope.path + "/io.pressure");
+        if (pressureTotal(io, "some", some) && pressureTotal(io, "full", full))
+        {
+            std::snprintf(buf, sizeof(buf), "%.1fms full %.1fms", some, full);
+            report << " io.pressure some " << buf;
+        }
+
+        if (!report.str().empty())
+            std::cerr << "kubsh: limit:" << report.str() << std::endl;
+
+        if (rmdir(scope.path.c_str()) == -1)
+        {
+            // Команда оставила после себя процессы — не трогаем их
+            std::cerr << "kubsh: " << scope.path << ": " << std::strerror(errno) << ", left in place" << std::endl;
+        }
+        scope.path.clear();
+    }
+
+    void describe(const Limits &defaults)
+    {
+        if (!prepare())
+            return;
+
+        std::string controllers = readFile(base + "/cgroup.subtree_control");
+        while (!controllers.empty() && controllers.back() == '\n')
+            controllers.pop_back();
+        std::cout << "cgroup: " << base << std::endl
+                  << "controllers: " << (controllers.empty() ? "(none)" : controllers) << std::endl;
+
+        if (defaults.any())
+        {
+            std::cout << "default:";
+            if (!defaults.cpuMax.empty())
+                std::cout << " cpu.max=\"" << defaults.cpuMax << "\"";
+            if (!defaults.memoryMax.empty())
+                std::cout << " memory.max=" << defaults.memoryMax;
+            if (!defaults.ioBps.empty())
+                std::cout << " io=" << defaults.ioBps;
+            std::cout << std::endl;
+        }
+    }
+
+}
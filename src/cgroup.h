@@ -0,0 +1,49 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <string>
+#include <sys/types.h>
+
+namespace Cgroup
+{
+    // Ограничения для команды; пустое поле — не ограничивать
+    struct Limits
+    {
+        std::string cpuMax;    // строка для cpu.max, например "200000 100000" (cpu=2)
+        std::string memoryMax; // байты для memory.max (mem=4G)
+        std::string ioBps;     // байт/с на чтение и запись для io.max (io=50M)
+
+        bool any() const { return !cpuMax.empty() || !memoryMax.empty() || !ioBps.empty(); }
+    };
+
+    // Разбирает одно ограничение вида cpu=2, mem=4G, io=50M (или =max) в limits.
+    // При ошибке возвращает false и описание в error.
+    bool parseLimit(const std::string &option, Limits &limits, std::string &error);
+
+    // То же для нескольких ограничений через пробел (значение limit в ~/.kubshrc)
+    bool parseLimits(const std::string &text, Limits &limits, std::string &error);
+
+    // Временная cgroup одной команды или задания
+    struct Scope
+    {
+        std::string path;
+        int fd = -1; // O_DIRECTORY-дескриптор для clone3(CLONE_INTO_CGROUP)
+    };
+
+    // Создаёт cgroup рядом с kubsh в его делегированном поддереве cgroup v2 и
+    // записывает в неё ограничения. Неподдерживаемый контроллер — предупреждение,
+    // а не ошибка. false — cgroup v2 недоступна (причина уже напечатана).
+    bool create(const Limits &limits, Scope &scope);
+
+    // fork(), но потомок сразу рождается в scope: clone3(CLONE_INTO_CGROUP).
+    // На ядрах без clone3 — fork() с переносом потомка до exec.
+    pid_t spawn(const Scope &scope);
+
+    // Печатает memory.peak и PSI cpu/io за время жизни команды и удаляет cgroup
+    void finish(Scope &scope);
+
+    // Описание состояния для "\limit" без команды
+    void describe(const Limits &defaults);
+}
+
+#endif // CGROUP_H
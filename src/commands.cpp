@@ -1,4 +1,5 @@
 #include "commands.h"
+#include "signals.h"
 
 #include <iostream>
 #include <vector>
@@ -30,7 +31,7 @@ namespace Commands
     }
 
     // ===== commands =====
-    static void cmdEcho(const std::vector<std::string> &args)
+    static int cmdEcho(const std::vector<std::string> &args)
     {
         for (std::size_t i = 1; i < args.size(); ++i)
         {
@@ -41,14 +42,15 @@ namespace Commands
             }
         }
         std::cout << std::endl;
+        return 0;
     }
 
-    static void cmdEnv(const std::vector<std::string> &args)
+    static int cmdEnv(const std::vector<std::string> &args)
     {
         if (args.size() < 2)
         {
             std::cerr << "kubsh: \\e requires variable name" << std::endl;
-            return;
+            return 1;
         }
 
         const std::string &varName = args[1];
@@ -56,7 +58,7 @@ namespace Commands
         if (!value)
         {
             std::cerr << "kubsh: environment variable not found: " << varName << std::endl;
-            return;
+            return 1;
         }
 
         std::string valStr(value);
@@ -74,34 +76,38 @@ namespace Commands
         {
             std::cout << valStr << std::endl;
         }
+        return 0;
     }
 
-    static void cmdListPartitions(const std::vector<std::string> &args)
+    static int cmdListPartitions(const std::vector<std::string> &args)
     {
         if (args.size() < 2)
         {
             std::cerr << "kubsh: \\l requires device path" << std::endl;
-            return;
+            return 1;
         }
 
         std::ifstream procPartitions("/proc/partitions");
         if (procPartitions.is_open())
         {
             std::string line;
+            bool found = false;
             while (std::getline(procPartitions, line))
             {
                 if (line.find(args[1]) != std::string::npos)
                 {
                     std::cout << line << std::endl;
+                    found = true;
                 }
             }
-            return;
+            return found ? 0 : 1;
         }
 
         // fallback → lsblk
         pid_t pid = fork();
         if (pid == 0)
         {
+            Signals::resetForChild();
             execlp("lsblk", "lsblk", args[1].c_str(), "-o", "NAME,SIZE,TYPE,MOUNTPOINT", nullptr);
             std::perror("kubsh: lsblk failed");
             _exit(127);
@@ -110,14 +116,16 @@ namespace Commands
         {
             int status = 0;
             waitpid(pid, &status, 0);
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
         }
         else
         {
             std::perror("kubsh: fork failed");
+            return 1;
         }
     }
 
-    static void cmdCd(const std::vector<std::string> &args)
+    static int cmdCd(const std::vector<std::string> &args)
     {
         std::string target;
         if (args.size() < 2)
@@ -126,7 +134,7 @@ namespace Commands
             if (!home)
             {
                 std::cerr << "kubsh: cd: HOME not set" << std::endl;
-                return;
+                return 1;
             }
             target = home;
         }
@@ -138,11 +146,13 @@ namespace Commands
         if (chdir(target.c_str()) != 0)
         {
             std::perror("kubsh: cd");
+            return 1;
         }
+        return 0;
     }
 
     // ===== dispatcher =====
-    bool handleCommand(const std::vector<std::string> &args)
+    bool handleCommand(const std::vector<std::string> &args, int *status)
     {
         if (args.empty())
         {
@@ -150,38 +160,39 @@ namespace Commands
         }
 
         const std::string &cmd = args[0];
+        int rc = 0;
 
         if (cmd == "\\q")
         {
-            // Выход → main.cpp обработает break
-            return true;
+            // Выход → вызывающий код обработает break
+            rc = 0;
         }
-
-        if (cmd == "echo")
+        else if (cmd == "echo")
         {
-            cmdEcho(args);
-            return true;
+            rc = cmdEcho(args);
         }
-
-        if (cmd == "\\e")
+        else if (cmd == "\\e")
         {
-            cmdEnv(args);
-            return true;
+            rc = cmdEnv(args);
         }
-
-        if (cmd == "\\l")
+        else if (cmd == "\\l")
         {
-            cmdListPartitions(args);
-            return true;
+            rc = cmdListPartitions(args);
         }
-
-        if (cmd == "cd")
+        else if (cmd == "cd")
         {
-            cmdCd(args);
-            return true;
+            rc = cmdCd(args);
+        }
+        else
+        {
+            return false; // не встроенная команда
         }
 
-        return false; // не встроенная команда
+        if (status)
+        {
+            *status = rc;
+        }
+        return true;
     }
 
 }
@@ -6,8 +6,9 @@
 
 namespace Commands
 {
-    // Возвращает true, если команда обработана встроенными средствами
-    bool handleCommand(const std::vector<std::string> &args);
+    // Возвращает true, если команда обработана встроенными средствами.
+    // Код завершения встроенной команды записывается в *status, если он передан.
+    bool handleCommand(const std::vector<std::string> &args, int *status = nullptr);
 }
 
 #endif // COMMANDS_H
@@ -0,0 +1,175 @@
+#include "config.h"
+#include "utils.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+
+namespace Config
+{
+
+    static std::shared_ptr<const Settings> settings = std::make_shared<const Settings>();
+
+    static std::string getConfigFile()
+    {
+        const char *env = std::getenv("KUBSH_CONFIG");
+        if (env && *env)
+        {
+            return env;
+        }
+        const char *home = std::getenv("HOME");
+        if (!home)
+        {
+            return ".kubshrc";
+        }
+        std::filesystem::path path(home);
+        path /= ".kubshrc";
+        return path.string();
+    }
+
+    static std::string trim(const std::string &s)
+    {
+        std::size_t begin = s.find_first_not_of(" \t\r");
+        if (begin == std::string::npos)
+        {
+            return std::string();
+        }
+        std::size_t end = s.find_last_not_of(" \t\r");
+        return s.substr(begin, end - begin + 1);
+    }
+
+    static std::string unquote(const std::string &s)
+    {
+        if (s.size() >= 2 && s.front() == '"' && s.back() == '"')
+        {
+            return s.substr(1, s.size() - 2);
+        }
+        return s;
+    }
+
+    static bool parseSize(const std::string &value, std::size_t &out)
+    {
+        try
+        {
+            std::size_t pos = 0;
+            unsigned long long n = std::stoull(value, &pos);
+            if (pos != value.size())
+            {
+                return false;
+            }
+            out = static_cast<std::size_t>(n);
+            return true;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    static bool parseBool(const std::string &value, bool &out)
+    {
+        if (value == "1" || value == "on" || value == "true" || value == "yes")
+        {
+            out = true;
+            return true;
+        }
+        if (value == "0" || value == "off" || value == "false" || value == "no")
+        {
+            out = false;
+            return true;
+        }
+        return false;
+    }
+
+    std::shared_ptr<const Settings> current()
+    {
+        return std::atomic_load(&settings);
+    }
+
+    bool reload()
+    {
+        std::string path = getConfigFile();
+        auto next = std::make_shared<Settings>();
+
+        std::ifstream infile(path);
+        if (infile.is_open())
+        {
+            std::string line;
+            int lineno = 0;
+            while (std::getline(infile, line))
+            {
+                ++lineno;
+                line = trim(line);
+                if (line.empty() || line[0] == '#')
+                    continue;
+
+                std::size_t eq = line.find('=');
+                if (eq == std::string::npos)
+                {
+                    std::cerr << "kubsh: " << path << ":" << lineno << ": expected key = value" << std::endl;
+                    return false;
+                }
+
+                std::string key = trim(line.substr(0, eq));
+                std::string value = unquote(trim(line.substr(eq + 1)));
+
+                if (key == "prompt")
+                {
+                    next->prompt = value;
+                }
+                else if (key == "history_size")
+                {
+                    if (!parseSize(value, next->historySize))
+                    {
+                        std::cerr << "kubsh: " << path << ":" << lineno << ": invalid history_size: " << value << std::endl;
+                        return false;
+                    }
+                }
+                else if (key == "users_dir")
+                {
+                    next->usersDir = Utils::expandTilde(value);
+                }
+                else if (key == "zygote")
+                {
+                    if (!parseBool(value, next->zygote))
+                    {
+                        std::cerr << "kubsh: " << path << ":" << lineno << ": invalid zygote: " << value << std::endl;
+                        return false;
+                    }
+                }
+                else if (key == "limit")
+                {
+                    std::string error;
+                    if (!Cgroup::parseLimits(value, next->limits, error))
+                    {
+                        std::cerr << "kubsh: " << path << ":" << lineno << ": " << error << std::endl;
+                        return false;
+                    }
+                }
+                else if (key == "audit")
+                {
+                    if (!parseBool(value, next->audit))
+                    {
+                        std::cerr << "kubsh: " << path << ":" << lineno << ": invalid audit: " << value << std::endl;
+                        return false;
+                    }
+                }
+                else if (key == "audit_log")
+                {
+                    next->auditLog = Utils::expandTilde(value);
+                }
+                else
+                {
+                    std::cerr << "kubsh: " << path << ":" << lineno << ": unknown key: " << key << std::endl;
+                }
+            }
+        }
+
+        std::atomic_store(&settings, std::shared_ptr<const Settings>(std::move(next)));
+        return true;
+    }
+
+}
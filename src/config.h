@@ -0,0 +1,31 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "cgroup.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace Config
+{
+    struct Settings
+    {
+        std::string prompt = "kubsh> ";
+        std::size_t historySize = 0; // 0 — без ограничения
+        std::string usersDir;        // пусто — ~/users
+        bool zygote = false;         // запускать команды через помощника (читается при старте)
+        Cgroup::Limits limits;       // ограничения по умолчанию для каждой команды (limit = cpu=2 mem=4G)
+        bool audit = true;           // вести журнал команд
+        std::string auditLog;        // пусто — ~/.kubsh_audit
+    };
+
+    // Текущие настройки; снимок неизменяем, его можно держать сколько угодно
+    std::shared_ptr<const Settings> current();
+
+    // Перечитывает файл конфигурации ($KUBSH_CONFIG или ~/.kubshrc)
+    // и атомарно подменяет настройки. При ошибке разбора старые настройки остаются.
+    bool reload();
+}
+
+#endif // CONFIG_H
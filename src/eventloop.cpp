@@ -0,0 +1,615 @@
+#include "eventloop.h"
+
+#include <algorithm>
+#include <iostream>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace EventLoop
+{
+
+    // user_data/epoll data: 2 бита вида, 30 бит поколения наблюдения, 32 бита fd.
+    // Поколение отсекает поздние события от уже снятого наблюдения за тем же fd.
+    enum Kind : std::uint64_t
+    {
+        KindPoll = 1,
+        KindWrite = 2,
+        KindInternal = 3,
+    };
+
+    static std::uint64_t makeTag(Kind kind, std::uint32_t generation, int fd)
+    {
+        return (static_cast<std::uint64_t>(kind) << 62) |
+               (static_cast<std::uint64_t>(generation & 0x3fffffff) << 32) |
+               static_cast<std::uint32_t>(fd);
+    }
+
+    static Kind tagKind(std::uint64_t tag) { return static_cast<Kind>(tag >> 62); }
+    static std::uint32_t tagGeneration(std::uint64_t tag) { return static_cast<std::uint32_t>(tag >> 32) & 0x3fffffff; }
+    static int tagFd(std::uint64_t tag) { return static_cast<int>(static_cast<std::uint32_t>(tag)); }
+
+    struct Event
+    {
+        std::uint64_t tag;
+        std::int32_t result; // для poll — маска событий, для записи — результат write
+    };
+
+    struct Watch
+    {
+        Handler handler;
+        std::uint32_t generation;
+        bool armed;
+    };
+
+    static std::unordered_map<int, Watch> watches;
+    static std::unordered_map<int, std::deque<std::string>> writes; // front() — в полёте
+    static std::vector<std::function<void()>> tasks;
+    static std::uint32_t nextGeneration = 1;
+
+    class Backend
+    {
+    public:
+        virtual ~Backend() = default;
+        virtual const char *name() const = 0;
+        // true — наблюдение постоянное (epoll), false — одноразовое (poll в io_uring)
+        virtual bool persistent() const = 0;
+        virtual void arm(int fd, std::uint32_t generation) = 0;
+        virtual void disarm(int fd, std::uint32_t generation) = 0;
+        // Начинает запись; false — запись выполнена синхронно (результат в result)
+        virtual bool startWrite(int fd, const std::string &data, std::int32_t &result) = 0;
+        virtual void wait(int timeoutMs, std::vector<Event> &events) = 0;
+    };
+
+    // ===== epoll =====
+
+    class EpollBackend : public Backend
+    {
+    public:
+        EpollBackend() : ep(epoll_create1(EPOLL_CLOEXEC)) {}
+        ~EpollBackend() override { close(ep); }
+
+        bool ok() const { return ep != -1; }
+        const char *name() const override { return "epoll"; }
+        bool persistent() const override { return true; }
+
+        void arm(int fd, std::uint32_t generation) override
+        {
+            struct epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = makeTag(KindPoll, generation, fd);
+            if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1 && errno == EPERM)
+            {
+                // Обычные файлы epoll не поддерживает — они всегда готовы
+                always.push_back(ev.data.u64);
+            }
+        }
+
+        void disarm(int fd, std::uint32_t generation) override
+        {
+            epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+            std::uint64_t tag = makeTag(KindPoll, generation, fd);
+            for (auto it = always.begin(); it != always.end(); ++it)
+            {
+                if (*it == tag)
+                {
+                    always.erase(it);
+                    break;
+                }
+            }
+        }
+
+        bool startWrite(int fd, const std::string &data, std::int32_t &result) override
+        {
+            ssize_t n;
+            do
+            {
+                n = ::write(fd, data.data(), data.size());
+            } while (n == -1 && errno == EINTR);
+            result = n == -1 ? -errno : static_cast<std::int32_t>(n);
+            return false;
+        }
+
+        void wait(int timeoutMs, std::vector<Event> &events) override
+        {
+            for (std::uint64_t tag : always)
+            {
+                events.push_back(Event{tag, POLLIN});
+            }
+            if (!always.empty())
+            {
+                timeoutMs = 0;
+            }
+
+            struct epoll_event ready[64];
+            int n = epoll_wait(ep, ready, 64, timeoutMs);
+            for (int i = 0; i < n; ++i)
+            {
+                unsigned mask = 0;
+                if (ready[i].events & EPOLLIN)
+                    mask |= POLLIN;
+                if (ready[i].events & (EPOLLHUP | EPOLLRDHUP))
+                    mask |= POLLHUP;
+                if (ready[i].events & EPOLLERR)
+                    mask |= POLLERR;
+                events.push_back(Event{ready[i].data.u64, static_cast<std::int32_t>(mask)});
+            }
+        }
+
+    private:
+        int ep;
+        std::vector<std::uint64_t> always;
+    };
+
+    // ===== io_uring =====
+
+    // Работаем с кольцами напрямую через системные вызовы, без liburing
+    class UringBackend : public Backend
+    {
+    public:
+        UringBackend()
+        {
+            struct io_uring_params params{};
+            ring = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if (ring == -1)
+            {
+                return;
+            }
+            if (!supportsOps())
+            {
+                release();
+                return;
+            }
+
+            sqLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (singleMap)
+            {
+                sqLength = cqLength = std::max(sqLength, cqLength);
+            }
+
+            sqMap = mmap(nullptr, sqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+            cqMap = singleMap ? sqMap
+                              : mmap(nullptr, cqLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+            sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+            sqes = static_cast<struct io_uring_sqe *>(
+                mmap(nullptr, sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES));
+
+            if (sqMap == MAP_FAILED || cqMap == MAP_FAILED || sqes == MAP_FAILED)
+            {
+                release();
+                return;
+            }
+
+            char *sq = static_cast<char *>(sqMap);
+            sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+            sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            sqEntries = params.sq_entries;
+
+            char *cq = static_cast<char *>(cqMap);
+            cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+            localTail = *sqTail;
+        }
+
+        ~UringBackend() override { release(); }
+
+        bool ok() const { return ring != -1; }
+        const char *name() const override { return "io_uring"; }
+        bool persistent() const override { return false; }
+
+        void arm(int fd, std::uint32_t generation) override
+        {
+            struct io_uring_sqe *sqe = getSqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = POLLIN | POLLRDHUP;
+            sqe->user_data = makeTag(KindPoll, generation, fd);
+        }
+
+        void disarm(int fd, std::uint32_t generation) override
+        {
+            struct io_uring_sqe *sqe = getSqe();
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = makeTag(KindPoll, generation, fd);
+            sqe->user_data = makeTag(KindInternal, 0, 0);
+        }
+
+        bool startWrite(int fd, const std::string &data, std::int32_t &) override
+        {
+            struct io_uring_sqe *sqe = getSqe();
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<std::uint64_t>(data.data());
+            sqe->len = static_cast<std::uint32_t>(data.size());
+            sqe->off = static_cast<std::uint64_t>(-1); // текущая позиция / O_APPEND
+            sqe->user_data = makeTag(KindWrite, 0, fd);
+            return true;
+        }
+
+        void wait(int timeoutMs, std::vector<Event> &events) override
+        {
+            if (timeoutMs > 0)
+            {
+                // Таймаут завершается сам при первом же другом событии (off = 1)
+                timeout.tv_sec = timeoutMs / 1000;
+                timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+                struct io_uring_sqe *sqe = getSqe();
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->fd = -1;
+                sqe->addr = reinterpret_cast<std::uint64_t>(&timeout);
+                sqe->len = 1;
+                sqe->off = 1;
+                sqe->user_data = makeTag(KindInternal, 0, 0);
+            }
+
+            unsigned toSubmit = localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+
+            bool haveEvents = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) != *cqHead;
+            unsigned minComplete = (timeoutMs == 0 || haveEvents) ? 0 : 1;
+            if (toSubmit > 0 || minComplete > 0)
+            {
+                int rc;
+                do
+                {
+                    rc = static_cast<int>(syscall(__NR_io_uring_enter, ring, toSubmit, minComplete,
+                                                  minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+                } while (rc == -1 && errno == EINTR && minComplete == 0);
+            }
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head)
+            {
+                const struct io_uring_cqe &cqe = cqes[head & cqMask];
+                if (tagKind(cqe.user_data) != KindInternal)
+                {
+                    events.push_back(Event{cqe.user_data, cqe.res});
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+
+    private:
+        static constexpr unsigned entries = 256;
+
+        // Ядра 5.1–5.5 создают кольцо, но не знают IORING_OP_WRITE (5.6) и IORING_OP_TIMEOUT (5.4):
+        // записи истории отвергались бы с -EINVAL, а таймеры не срабатывали. IORING_REGISTER_PROBE
+        // появился в 5.6 вместе с WRITE, так что и его отсутствие — повод выбрать epoll
+        bool supportsOps()
+        {
+            constexpr unsigned maxOps = 256;
+            std::vector<char> buf(sizeof(struct io_uring_probe) + maxOps * sizeof(struct io_uring_probe_op));
+            auto *probe = reinterpret_cast<struct io_uring_probe *>(buf.data());
+            if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, maxOps) == -1)
+            {
+                return false;
+            }
+            for (unsigned op : {IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_WRITE, IORING_OP_TIMEOUT})
+            {
+                if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        struct io_uring_sqe *getSqe()
+        {
+            if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+            {
+                // Очередь полна — отправляем накопленное, не дожидаясь завершений
+                unsigned toSubmit = localTail - *sqHead;
+                __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+                syscall(__NR_io_uring_enter, ring, toSubmit, 0, 0, nullptr, 0);
+            }
+            unsigned index = localTail & sqMask;
+            struct io_uring_sqe *sqe = &sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqArray[index] = index;
+            ++localTail;
+            return sqe;
+        }
+
+        void release()
+        {
+            if (sqes && sqes != MAP_FAILED)
+                munmap(sqes, sqesLength);
+            if (cqMap && cqMap != MAP_FAILED && !singleMap)
+                munmap(cqMap, cqLength);
+            if (sqMap && sqMap != MAP_FAILED)
+                munmap(sqMap, sqLength);
+            if (ring != -1)
+                close(ring);
+            ring = -1;
+            sqes = nullptr;
+            sqMap = cqMap = nullptr;
+        }
+
+        int ring = -1;
+        bool singleMap = false;
+        void *sqMap = nullptr;
+        void *cqMap = nullptr;
+        std::size_t sqLength = 0;
+        std::size_t cqLength = 0;
+        std::size_t sqesLength = 0;
+
+        unsigned *sqHead = nullptr;
+        unsigned *sqTail = nullptr;
+        unsigned *sqArray = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqEntries = 0;
+        unsigned localTail = 0;
+        struct io_uring_sqe *sqes = nullptr;
+
+        unsigned *cqHead = nullptr;
+        unsigned *cqTail = nullptr;
+        unsigned cqMask = 0;
+        struct io_uring_cqe *cqes = nullptr;
+
+        struct __kernel_timespec timeout{};
+    };
+
+    // ===== loop =====
+
+    static std::unique_ptr<Backend> backendImpl;
+
+    void init()
+    {
+        if (backendImpl)
+        {
+            return;
+        }
+
+        const char *forced = std::getenv("KUBSH_EVENT_LOOP");
+        if (!forced || std::strcmp(forced, "epoll") != 0)
+        {
+            auto uring = std::make_unique<UringBackend>();
+            if (uring->ok())
+            {
+                backendImpl = std::move(uring);
+                return;
+            }
+        }
+
+        auto epoll = std::make_unique<EpollBackend>();
+        if (!epoll->ok())
+        {
+            std::perror("kubsh: epoll_create1 failed");
+            std::abort();
+        }
+        backendImpl = std::move(epoll);
+    }
+
+    const char *backend()
+    {
+        init();
+        return backendImpl->name();
+    }
+
+    void watch(int fd, Handler handler)
+    {
+        init();
+        auto it = watches.find(fd);
+        if (it != watches.end())
+        {
+            it->second.handler = std::move(handler);
+            return;
+        }
+
+        std::uint32_t generation = nextGeneration++ & 0x3fffffff;
+        watches[fd] = Watch{std::move(handler), generation, true};
+        backendImpl->arm(fd, generation);
+    }
+
+    void unwatch(int fd)
+    {
+        auto it = watches.find(fd);
+        if (it == watches.end())
+        {
+            return;
+        }
+        if (it->second.armed)
+        {
+            backendImpl->disarm(fd, it->second.generation);
+        }
+        watches.erase(it);
+    }
+
+    int pidfd(pid_t pid)
+    {
+#ifdef SYS_pidfd_open
+        return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+        (void)pid;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    // Запускает следующую запись в очереди fd; синхронные записи выполняются подряд
+    static void pumpWrites(int fd)
+    {
+        auto it = writes.find(fd);
+        while (it != writes.end() && !it->second.empty())
+        {
+            std::int32_t result = 0;
+            if (backendImpl->startWrite(fd, it->second.front(), result))
+            {
+                return; // результат придёт событием
+            }
+
+            std::string &front = it->second.front();
+            if (result > 0 && static_cast<std::size_t>(result) < front.size())
+            {
+                front.erase(0, static_cast<std::size_t>(result));
+                continue;
+            }
+            if (result < 0)
+            {
+                errno = -result;
+                std::perror("kubsh: write failed");
+            }
+            it->second.pop_front();
+        }
+        if (it != writes.end())
+        {
+            writes.erase(it);
+        }
+    }
+
+    void write(int fd, std::string data)
+    {
+        init();
+        if (data.empty())
+        {
+            return;
+        }
+        auto &queue = writes[fd];
+        queue.push_back(std::move(data));
+        if (queue.size() == 1)
+        {
+            pumpWrites(fd);
+        }
+    }
+
+    void post(std::function<void()> task)
+    {
+        tasks.push_back(std::move(task));
+    }
+
+    static void completeWrite(int fd, std::int32_t result)
+    {
+        auto it = writes.find(fd);
+        if (it == writes.end() || it->second.empty())
+        {
+            return;
+        }
+
+        std::string &front = it->second.front();
+        if (result > 0 && static_cast<std::size_t>(result) < front.size())
+        {
+            front.erase(0, static_cast<std::size_t>(result));
+        }
+        else
+        {
+            if (result < 0)
+            {
+                errno = -result;
+                std::perror("kubsh: write failed");
+            }
+            it->second.pop_front();
+        }
+
+        if (it->second.empty())
+        {
+            writes.erase(it);
+        }
+        else
+        {
+            pumpWrites(fd);
+        }
+    }
+
+    void runOnce(int timeoutMs)
+    {
+        init();
+
+        if (!tasks.empty())
+        {
+            std::vector<std::function<void()>> ready;
+            ready.swap(tasks);
+            for (auto &task : ready)
+            {
+                task();
+            }
+            timeoutMs = 0;
+        }
+
+        std::vector<Event> events;
+        backendImpl->wait(timeoutMs, events);
+
+        for (const Event &event : events)
+        {
+            int fd = tagFd(event.tag);
+
+            if (tagKind(event.tag) == KindWrite)
+            {
+                completeWrite(fd, event.result);
+                continue;
+            }
+
+            auto it = watches.find(fd);
+            if (it == watches.end() || it->second.generation != tagGeneration(event.tag))
+            {
+                continue; // наблюдение уже снято
+            }
+            if (!backendImpl->persistent())
+            {
+                it->second.armed = false;
+            }
+            if (event.result == -ECANCELED)
+            {
+                continue;
+            }
+
+            unsigned mask = event.result < 0 ? POLLERR : static_cast<unsigned>(event.result);
+            if (mask & POLLRDHUP)
+            {
+                mask |= POLLHUP;
+            }
+            std::uint32_t generation = it->second.generation;
+
+            // Обработчик может снять или заменить собственное наблюдение
+            Handler handler = it->second.handler;
+            handler(mask);
+
+            it = watches.find(fd);
+            if (it != watches.end() && it->second.generation == generation && !it->second.armed)
+            {
+                it->second.armed = true;
+                backendImpl->arm(fd, generation);
+            }
+        }
+    }
+
+    void flush()
+    {
+        while (!writes.empty())
+        {
+            runOnce(-1);
+        }
+    }
+
+    void resetAfterFork()
+    {
+        // Кольцо io_uring и набор epoll общие с родителем — заводим свои
+        backendImpl.reset();
+        watches.clear();
+        writes.clear();
+        tasks.clear();
+    }
+
+}
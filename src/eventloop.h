@@ -0,0 +1,47 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <functional>
+#include <string>
+#include <sys/types.h>
+
+namespace EventLoop
+{
+    // Обработчик готовности дескриптора; events — маска poll (POLLIN, POLLHUP, ...)
+    using Handler = std::function<void(unsigned events)>;
+
+    // Основной бэкенд — io_uring; если ядро его не даёт (или KUBSH_EVENT_LOOP=epoll) — epoll.
+    // Вызывать явно не обязательно: цикл инициализируется при первом обращении.
+    void init();
+
+    // "io_uring" или "epoll"
+    const char *backend();
+
+    // Следит за готовностью fd к чтению. Повторный вызов для того же fd заменяет обработчик.
+    void watch(int fd, Handler handler);
+    void unwatch(int fd);
+
+    // pidfd процесса (O_CLOEXEC) для watch(): становится читаемым, когда процесс завершился.
+    // -1, если ядро pidfd не поддерживает — тогда остаётся SIGCHLD
+    int pidfd(pid_t pid);
+
+    // Дописывает data в fd. Записи в один fd выполняются строго по очереди;
+    // в io_uring — асинхронно, вместе с ближайшей отправкой очереди, в epoll — сразу.
+    void write(int fd, std::string data);
+
+    // Выполняет задачу на следующей итерации цикла, до ожидания событий
+    void post(std::function<void()> task);
+
+    // Одна итерация: отправить накопленные запросы, дождаться событий (timeoutMs: -1 — без
+    // ограничения, 0 — не ждать) и вызвать обработчики
+    void runOnce(int timeoutMs = -1);
+
+    // Дожидается завершения всех отложенных записей
+    void flush();
+
+    // Для fork без exec: дочерний процесс получает пустой цикл на новом бэкенде.
+    // Наблюдения и незавершённые записи родителя отбрасываются.
+    void resetAfterFork();
+}
+
+#endif // EVENTLOOP_H
@@ -1,25 +1,218 @@
 #include "executor.h"
+#include "audit.h"
+#include "cgroup.h"
+#include "config.h"
+#include "eventloop.h"
+#include "signals.h"
 #include "utils.h" // для expandTilde
+#include "zygote.h"
 
 #include <iostream>
 #include <vector>
 #include <string>
+#include <csignal>
+#include <cerrno>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <cstring>
+#include <cstdlib>
+#include <unordered_map>
 
 namespace Executor
 {
 
-    int runExternal(const std::vector<std::string> &args)
+    // Кэш путей команд (аналог hash в bash): заполняется по мере использования
+    // и сбрасывается целиком, если изменился PATH
+    static std::unordered_map<std::string, std::string> pathCache;
+    static std::string cachedPath;
+
+    static std::string resolveCommand(const std::string &cmd)
+    {
+        if (cmd.empty() || cmd.find('/') != std::string::npos)
+        {
+            return cmd;
+        }
+
+        const char *env = std::getenv("PATH");
+        std::string path = env ? env : "";
+        if (path != cachedPath)
+        {
+            pathCache.clear();
+            cachedPath = path;
+        }
+
+        auto it = pathCache.find(cmd);
+        if (it != pathCache.end())
+        {
+            return it->second;
+        }
+
+        std::size_t begin = 0;
+        while (begin <= path.size())
+        {
+            std::size_t end = path.find(':', begin);
+            if (end == std::string::npos)
+                end = path.size();
+
+            std::string dir = path.substr(begin, end - begin);
+            std::string candidate = (dir.empty() ? std::string(".") : dir) + "/" + cmd;
+            if (access(candidate.c_str(), X_OK) == 0)
+            {
+                pathCache.emplace(cmd, candidate);
+                return candidate;
+            }
+            begin = end + 1;
+        }
+
+        // Не нашли — пусть execvp сообщит об ошибке как обычно
+        return cmd;
+    }
+
+    // Терминал передаётся дочерней группе, только если kubsh сам на переднем плане
+    static bool ownsTerminal()
+    {
+        return isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+    }
+
+    // Ждёт завершения или остановки pid в EventLoop: завершение приходит через pidfd,
+    // остановка — через SIGCHLD в signalfd. Попутно обслуживаются VFS и фоновые задания
+    static int waitForeground(pid_t pid, int &status, struct rusage &usage)
+    {
+        bool done = false;
+        int rc = 0;
+        auto check = [&]()
+        {
+            if (done)
+                return;
+            pid_t r = wait4(pid, &status, WNOHANG | WUNTRACED, &usage);
+            if (r == pid)
+            {
+                done = true;
+            }
+            else if (r == -1 && errno != EINTR)
+            {
+                done = true;
+                rc = -1;
+            }
+        };
+
+        if (Signals::fd() == -1)
+        {
+            // signalfd недоступен — обычное блокирующее ожидание
+            pid_t r = wait4(pid, &status, WUNTRACED, &usage);
+            return r == pid ? 0 : -1;
+        }
+
+        int pidfd = EventLoop::pidfd(pid);
+        if (pidfd != -1)
+        {
+            EventLoop::watch(pidfd, [&](unsigned)
+                             { check(); });
+        }
+        Signals::watch([&](int signum)
+                       {
+                           if (signum == SIGCHLD)
+                               check();
+                       });
+
+        check();
+        while (!done)
+        {
+            EventLoop::runOnce();
+        }
+
+        Signals::watch();
+        if (pidfd != -1)
+        {
+            EventLoop::unwatch(pidfd);
+            close(pidfd);
+        }
+        return rc;
+    }
+
+    // То же для команды, запущенной помощником: статус приходит по его сокету
+    static int waitZygote(pid_t pid, int &status)
+    {
+        bool done = false;
+        int rc = 0;
+        EventLoop::watch(Zygote::fd(), [&](unsigned)
+                         {
+                             pid_t r = Zygote::readStatus(status);
+                             if (r == pid)
+                             {
+                                 done = true;
+                             }
+                             else if (r == -1)
+                             {
+                                 done = true;
+                                 rc = -1;
+                             }
+                         });
+
+        while (!done)
+        {
+            EventLoop::runOnce();
+        }
+
+        EventLoop::unwatch(Zygote::fd());
+        return rc;
+    }
+
+    // Ограничения для команды: явные или limit из конфигурации; nullptr — без cgroup
+    static const Cgroup::Limits *effectiveLimits(const Cgroup::Limits *limits,
+                                                 const std::shared_ptr<const Config::Settings> &settings)
+    {
+        if (!limits)
+        {
+            limits = &settings->limits;
+        }
+        return limits->any() ? limits : nullptr;
+    }
+
+    // Общая часть запуска: дочерний процесс в своей группе; возвращает pid или -1.
+    // terminal — передать ему терминал; viaZygote — запущен помощником;
+    // scope — временная cgroup, в которой потомок должен родиться (fd == -1 — без неё)
+    static pid_t spawn(const std::vector<std::string> &args, bool terminal, bool &viaZygote,
+                       const Cgroup::Scope &scope)
     {
         if (args.empty())
         {
             return -1;
         }
 
-        pid_t pid = fork();
+        std::vector<std::string> expanded;
+        expanded.reserve(args.size());
+        for (const auto &arg : args)
+        {
+            expanded.push_back(Utils::expandTilde(arg));
+        }
+        std::string program = resolveCommand(expanded[0]);
+
+        // argv собирается до fork: потомок clone3 (как и vfork) не должен выделять память,
+        // до exec он делает только async-signal-safe вызовы
+        std::vector<char *> argv;
+        argv.reserve(expanded.size() + 1);
+        for (auto &arg : expanded)
+        {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        // Через помощника, если он включён; при любой его ошибке — обычный fork
+        pid_t pid = -1;
+        viaZygote = false;
+        if (scope.fd == -1 && Config::current()->zygote && Zygote::available())
+        {
+            pid = Zygote::spawn(program, expanded, terminal);
+            viaZygote = pid != -1;
+        }
+
+        if (!viaZygote)
+        {
+            pid = scope.fd != -1 ? Cgroup::spawn(scope) : fork();
+        }
         if (pid < 0)
         {
             std::perror("kubsh: fork failed");
@@ -28,38 +221,93 @@ namespace Executor
 
         if (pid == 0)
         {
-            // Дочерний процесс
-            std::vector<std::string> expanded;
-            expanded.reserve(args.size());
-
-            for (const auto &arg : args)
+            // Дочерний процесс: своя группа процессов и, если можно, терминал
+            setpgid(0, 0);
+            if (terminal)
             {
-                expanded.push_back(Utils::expandTilde(arg));
+                tcsetpgrp(STDIN_FILENO, getpid());
             }
+            Signals::resetForChild();
 
-            std::vector<char *> argv;
-            argv.reserve(expanded.size() + 1);
-
-            for (auto &arg : expanded)
+            if (program != expanded[0])
             {
-                argv.push_back(const_cast<char *>(arg.c_str()));
+                execv(program.c_str(), argv.data());
+                // Файл из кэша мог исчезнуть — повторяем обычный поиск по PATH
             }
-            argv.push_back(nullptr);
-
             execvp(argv[0], argv.data());
 
-            // Если execvp вернулся, значит произошла ошибка
-            std::perror("kubsh: command not found");
+            // Если execvp вернулся, значит произошла ошибка. strerrordesc_np не зависит
+            // от локали и не выделяет память, в отличие от perror
+            const char *reason = strerrordesc_np(errno);
+            const char *parts[] = {"kubsh: command not found: ", argv[0], ": ", reason ? reason : "error", "\n"};
+            for (const char *part : parts)
+            {
+                ssize_t ignored = write(STDERR_FILENO, part, std::strlen(part));
+                (void)ignored;
+            }
             _exit(127);
         }
 
-        // Родительский процесс ждёт завершения
+        // Родительский процесс: группу потомка помощника выставляет сам помощник
+        if (!viaZygote)
+        {
+            setpgid(pid, pid);
+        }
+        return pid;
+    }
+
+    int runExternal(const std::vector<std::string> &args, const Cgroup::Limits *limits)
+    {
+        if (args.empty())
+        {
+            return -1;
+        }
+
+        // Без cgroup v2 команда всё равно выполняется, только без ограничений
+        auto settings = Config::current();
+        Cgroup::Scope scope;
+        if (const Cgroup::Limits *effective = effectiveLimits(limits, settings))
+        {
+            Cgroup::create(*effective, scope);
+        }
+
+        bool terminal = ownsTerminal();
+        bool viaZygote = false;
+        pid_t pid = spawn(args, terminal, viaZygote, scope);
+        if (pid < 0)
+        {
+            Cgroup::finish(scope);
+            return -1;
+        }
+
+        // Родительский процесс: повторяем tcsetpgrp, чтобы не зависеть от того,
+        // кто из двух успеет первым
+        if (terminal)
+        {
+            tcsetpgrp(STDIN_FILENO, pid);
+        }
+        Signals::setForeground(pid);
+
+        // Через помощника потомок не наш — rusage для журнала аудита нет
         int status = 0;
-        if (waitpid(pid, &status, 0) == -1)
+        struct rusage usage{};
+        int rc = viaZygote ? waitZygote(pid, status) : waitForeground(pid, status, usage);
+        Audit::noteChild(pid, viaZygote ? nullptr : &usage);
+
+        Signals::setForeground(0);
+        if (terminal)
+        {
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+        }
+
+        if (rc == -1)
         {
             std::perror("kubsh: waitpid failed");
+            Cgroup::finish(scope);
             return -1;
         }
+        // Остановленная команда остаётся в своей cgroup — finish() её не удалит
+        Cgroup::finish(scope);
 
         if (WIFEXITED(status))
         {
@@ -72,6 +320,13 @@ namespace Executor
             return 128 + WTERMSIG(status);
         }
 
+        if (WIFSTOPPED(status))
+        {
+            // Управления заданиями нет: процесс остаётся остановленным, печатаем его pid
+            std::cerr << "kubsh: stopped " << pid << " (signal " << WSTOPSIG(status) << ")" << std::endl;
+            return 128 + WSTOPSIG(status);
+        }
+
         return -1;
     }
 
@@ -1,14 +1,18 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
+#include "cgroup.h"
+
 #include <string>
 #include <vector>
 
 namespace Executor
 {
     // Запуск внешней команды через fork + execvp
-    // Возвращает код возврата дочернего процесса или -1 при ошибке fork/exec
-    int runExternal(const std::vector<std::string> &args);
+    // Возвращает код возврата дочернего процесса или -1 при ошибке fork/exec.
+    // limits — ограничения cgroup для команды (\limit); nullptr — limit из конфигурации.
+    // С ограничениями команда запускается в своей временной cgroup, минуя помощника.
+    int runExternal(const std::vector<std::string> &args, const Cgroup::Limits *limits = nullptr);
 }
 
 #endif // EXECUTOR_H
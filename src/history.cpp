@@ -1,17 +1,55 @@
 #include "history.h"
+#include "config.h"
+#include "eventloop.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <limits>
 #include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace History
 {
 
-    static std::vector<std::string> buffer;
-    static int index = -1;
+    // Все записи хранятся подряд в одном буфере без разделителей.
+    // offsets[i] — начало записи i, offsets.back() — конец последней,
+    // поэтому offsets всегда содержит на один элемент больше, чем записей.
+    static std::string arena;
+    static std::vector<std::uint32_t> offsets{0};
+    static std::size_t index = 0;
+    static bool loaded = false;
+    static int appendFd = -1; // файл истории для дозаписи, открывается при первом append()
+
+    // Снимок — это arena и offsets, сохранённые как есть после разбора первых fileSize байт
+    // файла истории. Файл только дописывается, поэтому снимок действителен, пока файл
+    // начинается с того же префикса (тот же inode, совпадает хеш его последних байт)
+    // и лимит не менялся; дописанный после снимка хвост разбирается отдельно.
+    struct SnapshotHeader
+    {
+        char magic[8];
+        std::uint64_t device;
+        std::uint64_t inode;
+        std::uint64_t fileSize;
+        std::uint64_t prefixHash; // FNV-1a последних prefixCheckBytes байт префикса
+        std::uint64_t historyLimit;
+        std::uint64_t count;
+        std::uint64_t arenaSize;
+    };
+
+    static constexpr char snapshotMagic[8] = {'K', 'U', 'B', 'H', 'I', 'S', 'T', '2'};
+    static constexpr std::size_t prefixCheckBytes = 4096;
+    // Хвост длиннее этого разбирается и сразу же сохраняется в новый снимок
+    static constexpr std::size_t resnapshotTail = 64 * 1024;
 
     static std::string getHistoryFile()
     {
@@ -25,49 +63,264 @@ namespace History
         return path.string();
     }
 
-    void load()
+    static std::string getSnapshotFile()
+    {
+        return getHistoryFile() + ".snap";
+    }
+
+    // Хеш конца префикса [0, size) файла истории; 0 — префикс не читается
+    // или не заканчивается переводом строки (тогда последняя запись могла быть недописана)
+    static std::uint64_t prefixHash(int fd, std::uint64_t size)
+    {
+        if (size == 0)
+            return 1;
+        std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(size, prefixCheckBytes));
+        std::string buf(length, '\0');
+        if (pread(fd, buf.data(), length, static_cast<off_t>(size - length)) != static_cast<ssize_t>(length) ||
+            buf.back() != '\n')
+            return 0;
+
+        std::uint64_t hash = 0xcbf29ce484222325ull;
+        for (unsigned char c : buf)
+        {
+            hash ^= c;
+            hash *= 0x100000001b3ull;
+        }
+        return hash ? hash : 1;
+    }
+
+    // Загружает снимок и возвращает размер префикса файла, который он покрывает
+    // (или -1, если снимок не подходит к файлу historyFd)
+    static off_t loadSnapshot(int historyFd, const struct stat &historyStat)
+    {
+        int fd = open(getSnapshotFile().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return -1;
+
+        struct stat st{};
+        if (fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(SnapshotHeader))
+        {
+            close(fd);
+            return -1;
+        }
+
+        std::size_t length = static_cast<std::size_t>(st.st_size);
+        void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+            return -1;
+
+        const char *base = static_cast<const char *>(map);
+        SnapshotHeader header;
+        std::memcpy(&header, base, sizeof(header));
+
+        bool valid = std::memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) == 0 &&
+                     header.device == static_cast<std::uint64_t>(historyStat.st_dev) &&
+                     header.inode == static_cast<std::uint64_t>(historyStat.st_ino) &&
+                     header.fileSize <= static_cast<std::uint64_t>(historyStat.st_size) &&
+                     header.prefixHash != 0 && header.prefixHash == prefixHash(historyFd, header.fileSize) &&
+                     header.historyLimit == Config::current()->historySize &&
+                     header.arenaSize <= std::numeric_limits<std::uint32_t>::max() &&
+                     header.count < length &&
+                     length == sizeof(header) + (header.count + 1) * sizeof(std::uint32_t) + header.arenaSize;
+
+        if (valid)
+        {
+            const char *offsetData = base + sizeof(header);
+            offsets.resize(header.count + 1);
+            std::memcpy(offsets.data(), offsetData, offsets.size() * sizeof(std::uint32_t));
+            arena.assign(offsetData + offsets.size() * sizeof(std::uint32_t), header.arenaSize);
+            // Смещения должны идти от 0 до arenaSize не убывая, иначе at() выйдет за arena
+            valid = offsets.front() == 0 && offsets.back() == header.arenaSize &&
+                    std::is_sorted(offsets.begin(), offsets.end());
+            if (!valid)
+            {
+                arena.clear();
+                offsets.assign(1, 0);
+            }
+        }
+
+        munmap(map, length);
+        return valid ? static_cast<off_t>(header.fileSize) : -1;
+    }
+
+    // Пишется во временный файл и атомарно подменяется rename().
+    // fileSize — сколько байт файла истории разобрано в arena
+    static void saveSnapshot(int historyFd, const struct stat &historyStat, std::uint64_t fileSize)
+    {
+        std::uint64_t hash = prefixHash(historyFd, fileSize);
+        if (hash == 0)
+            return; // последняя строка недописана — снимок с ней не совпадёт с файлом
+
+        std::string path = getSnapshotFile();
+        std::string tmp = path + ".tmp";
+
+        SnapshotHeader header{};
+        std::memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+        header.device = static_cast<std::uint64_t>(historyStat.st_dev);
+        header.inode = static_cast<std::uint64_t>(historyStat.st_ino);
+        header.fileSize = fileSize;
+        header.prefixHash = hash;
+        header.historyLimit = Config::current()->historySize;
+        header.count = offsets.size() - 1;
+        header.arenaSize = arena.size();
+
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            return;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(std::uint32_t));
+        out.write(arena.data(), arena.size());
+        out.close();
+
+        if (!out || std::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+        }
+    }
+
+    // Оставляет в памяти только keep последних записей
+    static void dropOldest(std::size_t keep)
+    {
+        std::size_t count = offsets.size() - 1;
+        if (keep >= count)
+            return;
+        std::uint32_t base = offsets[count - keep];
+
+        arena.erase(0, base);
+        offsets.erase(offsets.begin(), offsets.begin() + (count - keep));
+        for (auto &off : offsets)
+        {
+            off -= base;
+        }
+    }
+
+    // Применяет history_size из конфигурации. Обрезаем с запасом в 1/8,
+    // чтобы не сдвигать буфер на каждом append()
+    static void enforceLimit()
+    {
+        std::size_t limit = Config::current()->historySize;
+        if (limit > 0 && size() > limit + limit / 8)
+        {
+            dropOldest(limit);
+        }
+    }
+
+    static void push(std::string_view cmd)
     {
-        std::ifstream infile(getHistoryFile());
-        if (!infile.is_open())
+        constexpr std::size_t limit = std::numeric_limits<std::uint32_t>::max();
+        if (cmd.size() > limit)
             return;
+        // Отбрасываем старшую половину записей, чтобы смещения снова влезали в uint32_t
+        while (arena.size() + cmd.size() > limit && offsets.size() > 1)
+        {
+            dropOldest((offsets.size() - 1) / 2);
+        }
+
+        arena.append(cmd);
+        offsets.push_back(static_cast<std::uint32_t>(arena.size()));
+    }
+
+    // Разбирает текст истории начиная с байта from: читаем до конца и режем по '\n'
+    // без промежуточных std::string
+    static void parseHistoryFile(int fd, off_t from, off_t to)
+    {
+        std::string content(static_cast<std::size_t>(to - from), '\0');
+        std::size_t got = 0;
+        while (got < content.size())
+        {
+            ssize_t n = pread(fd, content.data() + got, content.size() - got, from + static_cast<off_t>(got));
+            if (n <= 0)
+                break;
+            got += static_cast<std::size_t>(n);
+        }
+        content.resize(got);
 
-        std::string line;
-        while (std::getline(infile, line))
+        arena.reserve(arena.size() + content.size());
+        std::string_view rest(content);
+        while (!rest.empty())
         {
+            std::size_t eol = rest.find('\n');
+            std::string_view line = rest.substr(0, eol);
             if (!line.empty())
-                buffer.push_back(line);
+                push(line);
+            if (eol == std::string_view::npos)
+                break;
+            rest.remove_prefix(eol + 1);
         }
-        index = buffer.size(); // курсор в конец
+        enforceLimit();
     }
 
-    const std::string &prev()
+    void load()
     {
-        static std::string empty;
-        if (buffer.empty())
-            return empty;
+        if (loaded)
+            return;
+        loaded = true;
+
+        // Строки, дописанные до загрузки, могут ещё стоять в очереди EventLoop
+        if (appendFd != -1)
+            EventLoop::flush();
+
+        int fd = open(getHistoryFile().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return;
+        struct stat st{};
+        if (fstat(fd, &st) == -1)
+        {
+            close(fd);
+            return;
+        }
+
+        // Снимок покрывает начало файла; дописанное после него разбирается как текст.
+        // Большой хвост (или отсутствие снимка) — повод сохранить снимок заново
+        off_t covered = loadSnapshot(fd, st);
+        off_t from = covered < 0 ? 0 : covered;
+        parseHistoryFile(fd, from, st.st_size);
+        if (covered < 0 || static_cast<std::size_t>(st.st_size - from) > resnapshotTail)
+            saveSnapshot(fd, st, static_cast<std::uint64_t>(st.st_size));
+        close(fd);
+        index = size(); // курсор в конец
+    }
+
+    std::size_t size()
+    {
+        load();
+        return offsets.size() - 1;
+    }
+
+    std::string_view at(std::size_t i)
+    {
+        if (i >= size())
+            return {};
+        return std::string_view(arena.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    std::string_view prev()
+    {
+        if (size() == 0)
+            return {};
 
         if (index > 0)
         {
             index--;
         }
-        return buffer[index];
+        return at(index);
     }
 
-    const std::string &next()
+    std::string_view next()
     {
-        static std::string empty;
-        if (buffer.empty())
-            return empty;
+        if (size() == 0)
+            return {};
 
-        if (index < (int)buffer.size() - 1)
+        if (index + 1 < size())
         {
             index++;
-            return buffer[index];
+            return at(index);
         }
         else
         {
-            index = buffer.size(); // вернуться к "новой строке"
-            return empty;
+            index = size(); // вернуться к "новой строке"
+            return {};
         }
     }
 
@@ -75,18 +328,24 @@ namespace History
     {
         if (cmd.empty())
             return;
-        buffer.push_back(cmd);
-        index = buffer.size();
 
-        std::ofstream outfile(getHistoryFile(), std::ios::app);
-        if (outfile.is_open())
+        // Пока история не загружена, достаточно дописать файл:
+        // запись попадёт в память при первой загрузке
+        if (loaded)
         {
-            outfile << cmd << std::endl;
+            push(cmd);
+            enforceLimit();
+            index = size();
         }
-    }
 
-    const std::vector<std::string> &all()
-    {
-        return buffer;
+        // Дозапись уходит в EventLoop: в io_uring она отправится вместе с ближайшим
+        // ожиданием ввода и не задерживает приглашение
+        if (appendFd == -1)
+        {
+            appendFd = open(getHistoryFile().c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+            if (appendFd == -1)
+                return;
+        }
+        EventLoop::write(appendFd, cmd + "\n");
     }
 }
@@ -1,8 +1,9 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include <cstddef>
 #include <string>
-#include <vector>
+#include <string_view>
 
 namespace History
 {
@@ -10,11 +11,14 @@ namespace History
     void append(const std::string &cmd);
 
     // Навигация по истории
-    const std::string &prev();
-    const std::string &next();
+    // Возвращаемые view действительны до следующего append()
+    std::string_view prev();
+    std::string_view next();
 
-    // Внутренний буфер истории
-    const std::vector<std::string> &all();
+    // Доступ к записям: все строки лежат в одном буфере,
+    // запись i — это срез [offsets[i], offsets[i + 1])
+    std::size_t size();
+    std::string_view at(std::size_t i);
 }
 
 #endif // HISTORY_H
@@ -1,13 +1,22 @@
 #include "input.h"
 #include "history.h"
+#include "config.h"
+#include "signals.h"
+#include "eventloop.h"
 
 #include <iostream>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
 
 namespace Input
 {
 
+    static bool reachedEof = false;
+
     static void setRawMode(bool enable)
     {
         static struct termios oldt;
@@ -30,18 +39,202 @@ namespace Input
         }
     }
 
+    // Прочитанные, но ещё не разобранные байты stdin
+    static std::string pending;
+    static std::size_t pendingPos = 0;
+
+    enum class Source
+    {
+        Unknown,
+        Terminal, // читаем сколько есть: при вставке текста это один read вместо сотни
+        File,     // читаем блоком, лишнее в конце строки возвращаем через lseek
+        Pipe,     // строку целиком, подсмотрев её через tee(): всё, что дальше, принадлежит запущенным командам
+    };
+
+    static Source source = Source::Unknown;
+
+    static std::size_t chunkSize()
+    {
+        if (source == Source::Unknown)
+        {
+            if (isatty(STDIN_FILENO))
+                source = Source::Terminal;
+            else if (lseek(STDIN_FILENO, 0, SEEK_CUR) != -1)
+                source = Source::File;
+            else
+                source = Source::Pipe;
+        }
+        switch (source)
+        {
+        case Source::Terminal:
+            return 256;
+        case Source::File:
+            return 4096;
+        default:
+            return 1;
+        }
+    }
+
+    // Возвращает непрочитанный остаток блока в файл, чтобы его увидели следующие команды.
+    // С терминала остаток (например, вставленные строки) ждёт следующего readline
+    static void returnUnread()
+    {
+        if (source != Source::File)
+            return;
+        if (pendingPos < pending.size())
+        {
+            lseek(STDIN_FILENO, -static_cast<off_t>(pending.size() - pendingPos), SEEK_CUR);
+        }
+        pending.clear();
+        pendingPos = 0;
+    }
+
+    // Копия начала канала stdin: tee() не забирает данные, и по копии видно, где кончается строка.
+    // -1 — не создана, -2 — tee() здесь недоступен (stdin не канал), читаем по байту
+    static int peekPipe[2] = {-1, -1};
+
+    // Читает из канала stdin ровно до конца строки (включительно) или всё доступное,
+    // если перевода строки пока нет. -1 — подсмотреть не удалось
+    static ssize_t readLine(char *buf, std::size_t size)
+    {
+        if (peekPipe[0] == -2)
+            return -1;
+        if (peekPipe[0] == -1 && pipe2(peekPipe, O_CLOEXEC) == -1)
+        {
+            peekPipe[0] = -2;
+            return -1;
+        }
+
+        auto disable = []
+        {
+            close(peekPipe[0]);
+            close(peekPipe[1]);
+            peekPipe[0] = peekPipe[1] = -2;
+        };
+
+        ssize_t avail = tee(STDIN_FILENO, peekPipe[1], size, SPLICE_F_NONBLOCK);
+        if (avail <= 0)
+        {
+            if (avail == -1 && errno == EINVAL)
+                disable();
+            return -1;
+        }
+
+        ssize_t seen = read(peekPipe[0], buf, static_cast<std::size_t>(avail));
+        if (seen != avail)
+        {
+            disable(); // недочитанная копия путала бы следующие строки
+            return -1;
+        }
+        const void *eol = std::memchr(buf, '\n', static_cast<std::size_t>(avail));
+        const void *cr = std::memchr(buf, '\r', static_cast<std::size_t>(avail));
+        if (!eol || (cr && cr < eol))
+            eol = cr;
+        std::size_t wanted = eol ? static_cast<std::size_t>(static_cast<const char *>(eol) - buf) + 1
+                                 : static_cast<std::size_t>(avail);
+        return read(STDIN_FILENO, buf, wanted);
+    }
+
+    static bool stdinReady = false;
+    static int pendingSignal = 0;
+
+    // Крутит EventLoop, пока stdin не станет готов; заодно обслуживаются VFS, задания и т.п.
+    // Возвращает номер сигнала, который требует реакции редактора, или 0, если stdin готов.
+    static int waitInput()
+    {
+        stdinReady = false;
+        pendingSignal = 0;
+        while (!stdinReady && pendingSignal == 0)
+        {
+            EventLoop::runOnce();
+        }
+        int signum = pendingSignal;
+        pendingSignal = 0;
+        return signum;
+    }
+
+    // Следующий байт ввода: 1 — байт в c, 0 — конец потока, иначе — номер сигнала (< 0)
+    static int nextByte(char &c)
+    {
+        while (pendingPos >= pending.size())
+        {
+            pending.clear();
+            pendingPos = 0;
+
+            int signum = waitInput();
+            if (signum != 0)
+                return -signum;
+
+            char buf[4096];
+            std::size_t chunk = chunkSize();
+            ssize_t n = source == Source::Pipe ? readLine(buf, sizeof(buf)) : -1;
+            if (n < 0)
+                n = read(STDIN_FILENO, buf, chunk);
+            if (n == 0)
+                return 0;
+            if (n < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN)
+                    continue;
+                return 0;
+            }
+            pending.assign(buf, static_cast<std::size_t>(n));
+        }
+        c = pending[pendingPos++];
+        return 1;
+    }
+
     std::string readline(const std::string &prompt)
     {
-        std::cout << prompt << std::flush;
+        std::string shown = prompt;
+        std::cout << shown << std::flush;
 
         std::string buffer;
         setRawMode(true);
 
+        EventLoop::watch(STDIN_FILENO, [](unsigned)
+                         { stdinReady = true; });
+        Signals::watch([](int signum)
+                       {
+                           if (pendingSignal == 0 && (signum == SIGINT || signum == SIGWINCH || signum == SIGHUP))
+                               pendingSignal = signum;
+                       });
+
         while (true)
         {
             char c;
-            if (read(STDIN_FILENO, &c, 1) != 1)
+            int got = nextByte(c);
+            int signum = got < 0 ? -got : 0;
+            if (signum == SIGINT)
+            {
+                // Ctrl+C в приглашении сбрасывает набранную строку
+                buffer.clear();
+                std::cout << "^C" << std::endl
+                          << shown << std::flush;
                 continue;
+            }
+            if (signum == SIGHUP || signum == SIGWINCH)
+            {
+                if (signum == SIGHUP)
+                    shown = Config::current()->prompt;
+                std::cout << "\33[2K\r" << shown << buffer << std::flush;
+                continue;
+            }
+            if (signum != 0)
+                continue;
+
+            if (got == 0)
+            {
+                // Конец входного потока ведёт себя как Ctrl+D. Недописанная последняя
+                // строка (без '\n') всё же выполняется; read() вернёт 0 и в следующий раз
+                if (!buffer.empty())
+                {
+                    std::cout << std::endl;
+                    break;
+                }
+                reachedEof = true;
+                break;
+            }
 
             if (c == '\n' || c == '\r')
             {
@@ -59,33 +252,34 @@ namespace Input
             else if (c == 27)
             { // escape sequence
                 char seq[2];
-                if (read(STDIN_FILENO, &seq[0], 1) != 1)
+                if (nextByte(seq[0]) != 1)
                     continue;
-                if (read(STDIN_FILENO, &seq[1], 1) != 1)
+                if (nextByte(seq[1]) != 1)
                     continue;
 
                 if (seq[0] == '[')
                 {
                     if (seq[1] == 'A')
                     { // up arrow
-                        std::string cmd = History::prev();
+                        std::string cmd(History::prev());
                         // стереть текущую строку
-                        std::cout << "\33[2K\r" << prompt << cmd << std::flush;
+                        std::cout << "\33[2K\r" << shown << cmd << std::flush;
                         buffer = cmd;
                     }
                     else if (seq[1] == 'B')
                     { // down arrow
-                        std::string cmd = History::next();
-                        std::cout << "\33[2K\r" << prompt << cmd << std::flush;
+                        std::string cmd(History::next());
+                        std::cout << "\33[2K\r" << shown << cmd << std::flush;
                         buffer = cmd;
                     }
                 }
             }
             else if (c == 4)
             { // Ctrl+D
-                setRawMode(false);
+                reachedEof = true;
+                buffer.clear(); // сигнал выхода
                 std::cout << std::endl;
-                return std::string(); // сигнал выхода
+                break;
             }
 
             else
@@ -95,7 +289,15 @@ namespace Input
             }
         }
 
+        EventLoop::unwatch(STDIN_FILENO);
+        Signals::watch();
+        returnUnread();
         setRawMode(false);
         return buffer;
     }
+
+    bool eof()
+    {
+        return reachedEof;
+    }
 }
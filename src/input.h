@@ -7,6 +7,9 @@ namespace Input
 {
     // Читает строку с поддержкой истории (стрелки ↑ и ↓)
     std::string readline(const std::string &prompt);
+
+    // true после Ctrl+D или конца входного потока
+    bool eof();
 }
 
 #endif // INPUT_H
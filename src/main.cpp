@@ -1,61 +1,188 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <chrono>
 #include <csignal>
+#include <cstdlib>
+#include <cstring>
 
-#include "utils.h"
-#include "commands.h"
-#include "executor.h"
+#include "audit.h"
+#include "config.h"
+#include "eventloop.h"
 #include "history.h"
+#include "parser.h"
+#include "script.h"
+#include "server.h"
+#include "zygote.h"
 #include "signals.h"
 #include "vfs.h"
 #include "input.h"
 
-int main()
+// Замер фаз запуска для --profile-startup; пишет в stderr, чтобы не мешать выводу команд
+class StartupProfile
 {
-    // Инициализация подсистем
-    History::load();
+public:
+    explicit StartupProfile(bool enabled)
+        : enabled(enabled), begin(std::chrono::steady_clock::now()), last(begin)
+    {
+    }
+
+    void phase(const char *name)
+    {
+        if (!enabled)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        std::cerr << "kubsh: startup " << name << " "
+                  << std::chrono::duration<double, std::milli>(now - last).count() << " ms" << std::endl;
+        last = now;
+    }
+
+    void firstPrompt()
+    {
+        if (!enabled)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        std::cerr << "kubsh: startup first-prompt "
+                  << std::chrono::duration<double, std::milli>(now - begin).count() << " ms" << std::endl;
+        enabled = false;
+    }
+
+private:
+    bool enabled;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point last;
+};
+
+int main(int argc, char *argv[])
+{
+    // kubsh --client args...: всё после флага — команда для сервера
+    if (argc > 1 && std::strcmp(argv[1], "--client") == 0)
+    {
+        return Server::client(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    // kubsh --query/--replay [фильтры]: чтение журнала аудита
+    if (argc > 1 && (std::strcmp(argv[1], "--query") == 0 || std::strcmp(argv[1], "--replay") == 0))
+    {
+        Config::reload();
+        return Audit::query(std::vector<std::string>(argv + 2, argv + argc), argv[1][2] == 'r');
+    }
+
+    // Помощник запуска команд (см. Zygote::start), сам по себе ничего не инициализирует
+    if (argc == 3 && std::strcmp(argv[1], "--zygote-helper") == 0)
+    {
+        return Zygote::serve(std::atoi(argv[2]));
+    }
+
+    bool profile = false;
+    bool server = false;
+    const char *command = nullptr;
+    const char *scriptFile = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--profile-startup") == 0)
+        {
+            profile = true;
+        }
+        else if (std::strcmp(argv[i], "--server") == 0)
+        {
+            server = true;
+        }
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            command = argv[++i];
+        }
+        else if (argv[i][0] != '-' && !scriptFile)
+        {
+            scriptFile = argv[i];
+        }
+        else
+        {
+            std::cerr << "kubsh: unknown option: " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    if (server)
+    {
+        Config::reload();
+        Signals::setup();
+        return Server::run();
+    }
+
+    // Пакетный режим: kubsh -c "cmd1 && cmd2" или kubsh script.ksh.
+    // Без истории и мониторинга VFS — они нужны только интерактивной сессии
+    if (command || scriptFile)
+    {
+        Config::reload();
+        if (Config::current()->zygote)
+        {
+            Zygote::start("/proc/self/exe");
+        }
+        Signals::setup();
+        int status = command ? Script::runLine(command) : Script::runFile(scriptFile);
+        Audit::flush();
+        EventLoop::flush();
+        return status;
+    }
+
+    // Инициализация подсистем. История загружается лениво при первом обращении,
+    // пользователи VFS обходятся первой задачей EventLoop, уже после приглашения
+    StartupProfile startup(profile);
+    Config::reload();
+    startup.phase("config");
+    if (Config::current()->zygote)
+    {
+        Zygote::start("/proc/self/exe");
+        startup.phase("zygote");
+    }
     Signals::setup();
+    startup.phase("signals");
     VFS::initUsers();
-
-    std::string line;
+    startup.phase("vfs");
 
     while (true)
     {
-        std::string line = Input::readline("kubsh> ");
+        startup.firstPrompt();
+
+        std::string line = Input::readline(Config::current()->prompt);
         if (line.empty())
         {
             // Пустая строка → возможно Ctrl+D
-            if (std::cin.eof())
+            if (Input::eof())
             {
                 break;
             }
             continue;
         }
 
-        std::vector<std::string> args = Utils::split(line);
-        if (args.empty())
+        Parser::CommandList list;
+        std::string error;
+        if (!Parser::parse(line, list, error))
         {
+            std::cerr << "kubsh: " << error << std::endl;
+            History::append(line);
             continue;
         }
-
-        if (Commands::handleCommand(args))
+        if (list.empty())
         {
-            History::append(line);
-            if (args[0] == "\\q")
-            {
-                break;
-            }
             continue;
         }
 
-        int status = Executor::runExternal(args);
+        int status = Script::run(list);
+        History::append(line);
+        if (Script::exitRequested())
+        {
+            break;
+        }
         if (status != 0)
         {
             std::cerr << "kubsh: command failed with code " << status << std::endl;
         }
-        History::append(line);
     }
 
+    VFS::drain();
+    Audit::flush();
+    EventLoop::flush();
     return 0;
 }
@@ -0,0 +1,92 @@
+#include "parser.h"
+#include "utils.h"
+
+#include <string>
+#include <vector>
+
+namespace Parser
+{
+
+    // Добавляет команду из фрагмента строки; пустой фрагмент допустим только
+    // в конце после ';' (например, "ls;")
+    static bool addCommand(const std::string &segment, Connector connector, bool last,
+                           CommandList &list, std::string &error)
+    {
+        std::vector<std::string> args = Utils::split(segment);
+        if (args.empty())
+        {
+            if (last && (connector == Connector::Seq))
+            {
+                return true;
+            }
+            error = list.empty() && !last ? "syntax error: command expected at start of line"
+                                          : "syntax error: command expected after operator";
+            return false;
+        }
+
+        list.push_back(Command{connector, std::move(args)});
+        return true;
+    }
+
+    bool parse(const std::string &line, CommandList &list, std::string &error)
+    {
+        list.clear();
+
+        std::string segment;
+        Connector connector = Connector::Seq;
+        bool inQuotes = false;
+
+        for (std::size_t i = 0; i < line.size(); ++i)
+        {
+            char c = line[i];
+
+            if (c == '"')
+            {
+                // Кавычки снимает Utils::split, здесь только отслеживаем их
+                inQuotes = !inQuotes;
+                segment.push_back(c);
+                continue;
+            }
+
+            Connector next = Connector::Seq;
+            std::size_t width = 0;
+            if (!inQuotes && c == ';')
+            {
+                next = Connector::Seq;
+                width = 1;
+            }
+            else if (!inQuotes && c == '&' && i + 1 < line.size() && line[i + 1] == '&')
+            {
+                next = Connector::And;
+                width = 2;
+            }
+            else if (!inQuotes && c == '|' && i + 1 < line.size() && line[i + 1] == '|')
+            {
+                next = Connector::Or;
+                width = 2;
+            }
+
+            if (width == 0)
+            {
+                segment.push_back(c);
+                continue;
+            }
+
+            if (!addCommand(segment, connector, false, list, error))
+            {
+                return false;
+            }
+            segment.clear();
+            connector = next;
+            i += width - 1;
+        }
+
+        // Пустая строка целиком — пустой список, это не ошибка
+        if (list.empty() && Utils::split(segment).empty() && connector == Connector::Seq)
+        {
+            return true;
+        }
+        return addCommand(segment, connector, true, list, error);
+    }
+
+}
@@ -0,0 +1,32 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <string>
+#include <vector>
+
+namespace Parser
+{
+    // Как команда связана с предыдущей в списке
+    enum class Connector
+    {
+        Seq, // ';' или первая команда — выполняется всегда
+        And, // '&&' — только если предыдущая завершилась с кодом 0
+        Or,  // '||' — только если предыдущая завершилась с ошибкой
+    };
+
+    struct Command
+    {
+        Connector connector = Connector::Seq;
+        std::vector<std::string> args;
+    };
+
+    // Список команд одной строки; вычисляется слева направо,
+    // т.е. "a || b && c" означает "(a || b) && c", как в sh
+    using CommandList = std::vector<Command>;
+
+    // Разбирает строку на команды по ';', '&&' и '||' вне кавычек.
+    // Возвращает false и описание в error при синтаксической ошибке.
+    bool parse(const std::string &line, CommandList &list, std::string &error);
+}
+
+#endif // PARSER_H
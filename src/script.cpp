@@ -0,0 +1,155 @@
+#include "script.h"
+#include "audit.h"
+#include "commands.h"
+#include "config.h"
+#include "executor.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Script
+{
+
+    static bool quit = false;
+
+    // \limit cpu=2 mem=4G io=50M cmd args...: команда во временной cgroup v2.
+    // Ограничения дополняют limit из конфигурации; без команды — показать состояние
+    static int runLimited(const std::vector<std::string> &args)
+    {
+        Cgroup::Limits limits = Config::current()->limits;
+        std::size_t i = 1;
+        for (; i < args.size() && args[i].find('=') != std::string::npos; ++i)
+        {
+            std::string error;
+            if (!Cgroup::parseLimit(args[i], limits, error))
+            {
+                std::cerr << "kubsh: \\limit: " << error << std::endl;
+                return 2;
+            }
+        }
+
+        std::vector<std::string> command(args.begin() + static_cast<std::ptrdiff_t>(i), args.end());
+        if (command.empty())
+        {
+            Cgroup::describe(limits);
+            return 0;
+        }
+        // Команда под ограничениями — всегда внешняя программа (echo — /bin/echo)
+        if (command[0][0] == '\\')
+        {
+            std::cerr << "kubsh: \\limit applies only to external commands" << std::endl;
+            return 2;
+        }
+        return Executor::runExternal(command, &limits);
+    }
+
+    static int runCommand(const std::vector<std::string> &args)
+    {
+        if (args[0] == "\\q")
+        {
+            quit = true;
+            return 0;
+        }
+        if (args[0] == "\\limit")
+        {
+            return runLimited(args);
+        }
+
+        int status = 0;
+        if (Commands::handleCommand(args, &status))
+        {
+            return status;
+        }
+        return Executor::runExternal(args);
+    }
+
+    int run(const Parser::CommandList &list)
+    {
+        int status = 0;
+        for (const auto &cmd : list)
+        {
+            if (quit)
+            {
+                break;
+            }
+            if (cmd.connector == Parser::Connector::And && status != 0)
+            {
+                continue;
+            }
+            if (cmd.connector == Parser::Connector::Or && status == 0)
+            {
+                continue;
+            }
+            Audit::begin(cmd.args);
+            status = runCommand(cmd.args);
+            Audit::end(status);
+        }
+        return status;
+    }
+
+    int runLine(const std::string &line)
+    {
+        Parser::CommandList list;
+        std::string error;
+        if (!Parser::parse(line, list, error))
+        {
+            std::cerr << "kubsh: " << error << std::endl;
+            return 2;
+        }
+        return run(list);
+    }
+
+    int runFile(const std::string &path)
+    {
+        std::ifstream infile(path);
+        if (!infile.is_open())
+        {
+            std::cerr << "kubsh: cannot open " << path << std::endl;
+            return 127;
+        }
+
+        std::vector<Parser::CommandList> program;
+        std::string line;
+        std::string error;
+        int lineno = 0;
+        while (std::getline(infile, line))
+        {
+            ++lineno;
+            std::size_t first = line.find_first_not_of(" \t");
+            if (first == std::string::npos || line[first] == '#')
+            {
+                continue;
+            }
+
+            Parser::CommandList list;
+            if (!Parser::parse(line, list, error))
+            {
+                std::cerr << "kubsh: " << path << ":" << lineno << ": " << error << std::endl;
+                return 2;
+            }
+            if (!list.empty())
+            {
+                program.push_back(std::move(list));
+            }
+        }
+
+        int status = 0;
+        for (const auto &list : program)
+        {
+            if (quit)
+            {
+                break;
+            }
+            status = run(list);
+        }
+        return status;
+    }
+
+    bool exitRequested()
+    {
+        return quit;
+    }
+
+}
@@ -0,0 +1,26 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "parser.h"
+
+#include <string>
+
+namespace Script
+{
+    // Выполняет список команд в текущем процессе: встроенные — напрямую,
+    // внешние — через Executor. Пропущенные по && / || команды не запускаются.
+    // Возвращает код завершения последней выполненной команды.
+    int run(const Parser::CommandList &list);
+
+    // Разбирает и выполняет одну строку; синтаксическая ошибка даёт код 2
+    int runLine(const std::string &line);
+
+    // Выполняет файл сценария. Все строки разбираются до начала выполнения,
+    // поэтому синтаксическая ошибка в любом месте не запускает ни одной команды.
+    int runFile(const std::string &path);
+
+    // true после выполнения \q
+    bool exitRequested();
+}
+
+#endif // SCRIPT_H
@@ -0,0 +1,578 @@
+#include "server.h"
+#include "audit.h"
+#include "eventloop.h"
+#include "history.h"
+#include "script.h"
+#include "signals.h"
+#include "vfs.h"
+
+#include <iostream>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace Server
+{
+
+    // Запрос — одно сообщение SOCK_SEQPACKET: заголовок, затем "cwd\0" и тело,
+    // а в управляющих данных SCM_RIGHTS — stdin, stdout и stderr клиента.
+    // Тело — строка команды (Line) или аргументы, каждый с '\0' в конце (Argv):
+    // argv доходит до сервера без повторного разбора и без потерь на кавычках.
+    // Ответ — одно сообщение с int32 кодом завершения или shutDown.
+    struct RequestHeader
+    {
+        std::uint32_t magic;
+        std::uint32_t length;
+        std::uint32_t kind;
+    };
+
+    enum RequestKind : std::uint32_t
+    {
+        Line = 0,
+        Argv = 1,
+    };
+
+    struct Request
+    {
+        std::string cwd;
+        std::uint32_t kind = Line;
+        std::string line;              // Line
+        std::vector<std::string> args; // Argv
+    };
+
+    static constexpr std::uint32_t requestMagic = 0x4b554232; // "KUB2": с полем kind
+    static constexpr std::size_t maxRequest = 64 * 1024;
+
+    std::string socketPath()
+    {
+        const char *env = std::getenv("KUBSH_SOCKET");
+        if (env && *env)
+        {
+            return env;
+        }
+        const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+        if (runtime && *runtime)
+        {
+            return std::string(runtime) + "/kubsh.sock";
+        }
+        const char *home = std::getenv("HOME");
+        std::filesystem::path path(home ? home : ".");
+        path /= ".kubsh.sock";
+        return path.string();
+    }
+
+    static bool fillAddress(const std::string &path, struct sockaddr_un &addr)
+    {
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            std::cerr << "kubsh: socket path too long: " << path << std::endl;
+            return false;
+        }
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // ===== client =====
+
+    static int sendRequest(RequestKind kind, const std::string &body, const int fds[3])
+    {
+        struct sockaddr_un addr;
+        if (!fillAddress(socketPath(), addr))
+        {
+            return -1;
+        }
+
+        int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (sock == -1)
+        {
+            return -1;
+        }
+        if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1)
+        {
+            close(sock);
+            return -1;
+        }
+
+        char cwd[4096];
+        if (!getcwd(cwd, sizeof(cwd)))
+        {
+            cwd[0] = '\0';
+        }
+
+        std::string payload = std::string(cwd) + '\0' + body;
+        if (payload.size() > maxRequest)
+        {
+            std::cerr << "kubsh: command too long" << std::endl;
+            close(sock);
+            return -1;
+        }
+        RequestHeader header{requestMagic, static_cast<std::uint32_t>(payload.size()), kind};
+
+        struct iovec iov[2] = {
+            {&header, sizeof(header)},
+            {payload.data(), payload.size()},
+        };
+
+        union
+        {
+            char buf[CMSG_SPACE(3 * sizeof(int))];
+            struct cmsghdr align;
+        } control{};
+
+        struct msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1)
+        {
+            close(sock);
+            return -1;
+        }
+
+        std::int32_t status = -1;
+        ssize_t n;
+        do
+        {
+            n = recv(sock, &status, sizeof(status), 0);
+        } while (n == -1 && errno == EINTR);
+        close(sock);
+
+        return n == static_cast<ssize_t>(sizeof(status)) ? status : -1;
+    }
+
+    int request(const std::string &command, const int fds[3])
+    {
+        return sendRequest(Line, command, fds);
+    }
+
+    int request(const std::vector<std::string> &args, const int fds[3])
+    {
+        std::string body;
+        for (const auto &arg : args)
+        {
+            body += arg;
+            body.push_back('\0');
+        }
+        return sendRequest(Argv, body, fds);
+    }
+
+    int client(const std::vector<std::string> &args)
+    {
+        const int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+        // "--client -c LINE" передаёт строку как есть, с операторами ; && ||
+        int status = args.size() == 2 && args[0] == "-c" ? request(args[1], fds) : request(args, fds);
+        if (status == -1)
+        {
+            std::cerr << "kubsh: no server at " << socketPath() << std::endl;
+            return 127;
+        }
+        if (status == shutDown)
+        {
+            std::cerr << "kubsh: server at " << socketPath() << " shut down" << std::endl;
+            return 128 + SIGHUP;
+        }
+        return status;
+    }
+
+    // ===== server =====
+
+    struct Session
+    {
+        int sock;
+        pid_t pid;
+        int pidfd; // -1, пока команда не запущена или если pidfd не поддерживается
+    };
+
+    static int listenSocket(const std::string &path)
+    {
+        struct sockaddr_un addr;
+        if (!fillAddress(path, addr))
+        {
+            return -1;
+        }
+
+        int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock == -1)
+        {
+            std::perror("kubsh: socket failed");
+            return -1;
+        }
+
+        // Сокет от прошлого запуска: если к нему никто не отвечает — удаляем
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (connect(probe, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0)
+        {
+            std::cerr << "kubsh: server already running at " << path << std::endl;
+            close(probe);
+            close(sock);
+            return -1;
+        }
+        close(probe);
+        unlink(path.c_str());
+
+        mode_t old = umask(0077);
+        int rc = bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        umask(old);
+        if (rc == -1 || listen(sock, SOMAXCONN) == -1)
+        {
+            std::perror("kubsh: bind failed");
+            close(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    // Принимает запрос сессии; возвращает false, если запрос некорректен
+    static bool receiveRequest(int sock, int fds[3], Request &request)
+    {
+        std::vector<char> buf(sizeof(RequestHeader) + maxRequest);
+        union
+        {
+            char buf[CMSG_SPACE(3 * sizeof(int))];
+            struct cmsghdr align;
+        } control{};
+
+        struct iovec iov{buf.data(), buf.size()};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < static_cast<ssize_t>(sizeof(RequestHeader)))
+        {
+            return false;
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        bool haveFds = cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                       cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int));
+        if (haveFds)
+        {
+            std::memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+        }
+
+        RequestHeader header;
+        std::memcpy(&header, buf.data(), sizeof(header));
+        std::string payload(buf.data() + sizeof(header), static_cast<std::size_t>(n) - sizeof(header));
+        std::size_t sep = payload.find('\0');
+
+        if (!haveFds || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || header.magic != requestMagic ||
+            header.length != payload.size() || sep == std::string::npos ||
+            (header.kind == Argv && payload.back() != '\0') || header.kind > Argv)
+        {
+            if (haveFds)
+            {
+                for (int i = 0; i < 3; ++i)
+                    close(fds[i]);
+            }
+            return false;
+        }
+
+        request.cwd = payload.substr(0, sep);
+        request.kind = header.kind;
+        if (request.kind == Line)
+        {
+            request.line = payload.substr(sep + 1);
+            return true;
+        }
+        for (std::size_t begin = sep + 1; begin < payload.size();)
+        {
+            std::size_t end = payload.find('\0', begin);
+            request.args.push_back(payload.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        return !request.args.empty();
+    }
+
+    // Строка для истории сервера; argv уже разобран, она только для показа
+    static std::string historyLine(const std::vector<std::string> &args)
+    {
+        std::string line;
+        for (const auto &arg : args)
+        {
+            if (!line.empty())
+                line.push_back(' ');
+            bool quote = arg.empty() || arg.find_first_of(" \t;&|") != std::string::npos;
+            line += quote ? '"' + arg + '"' : arg;
+        }
+        return line;
+    }
+
+    // Принимаем только процессы того же пользователя
+    static bool samePeer(int sock)
+    {
+        struct ucred cred{};
+        socklen_t len = sizeof(cred);
+        return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+    }
+
+    static void reply(int sock, int status)
+    {
+        std::int32_t value = status;
+        send(sock, &value, sizeof(value), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+
+    // Запускает команду сессии в дочернем процессе с дескрипторами клиента.
+    // inherited — дескрипторы сервера, которые дочернему процессу не нужны
+    static pid_t startSession(const int fds[3], const Request &request, const std::vector<int> &inherited)
+    {
+        pid_t pid = fork();
+        if (pid != 0)
+        {
+            return pid;
+        }
+
+        for (int fd : inherited)
+        {
+            close(fd);
+        }
+        EventLoop::resetAfterFork();
+        Signals::watch();
+
+        // Своя группа процессов: при обрыве клиента сервер шлёт ей SIGHUP,
+        // а сессия пересылает его запущенной команде и завершается
+        setpgid(0, 0);
+        Signals::setHangupExits(true);
+        Signals::setTerminateExits(true);
+        for (int i = 0; i < 3; ++i)
+        {
+            dup2(fds[i], i);
+        }
+        if (!request.cwd.empty() && chdir(request.cwd.c_str()) == -1)
+        {
+            std::perror("kubsh: chdir");
+        }
+
+        int status = 0;
+        if (request.kind == Argv)
+        {
+            Parser::Command command;
+            command.args = request.args;
+            status = Script::run(Parser::CommandList{command});
+        }
+        else
+        {
+            status = Script::runLine(request.line);
+        }
+        Audit::flush();
+        std::cout.flush();
+        std::cerr.flush();
+        _exit(status & 0xff);
+    }
+
+    int run()
+    {
+        std::string path = socketPath();
+        int listener = listenSocket(path);
+        if (listener == -1)
+        {
+            return 1;
+        }
+
+        // Прогреваем то, что иначе грузилось бы при каждом холодном запуске
+        History::load();
+        VFS::initUsers();
+
+        // SIGTERM, как и SIGINT, — штатная остановка: сначала закрыть сессии
+        Signals::setTerminateExits(false);
+        std::cerr << "kubsh: server listening on " << path << std::endl;
+
+        std::unordered_map<int, Session> bySock;
+        std::unordered_map<pid_t, int> byPid;
+        bool running = true;
+
+        auto closeSession = [&](int sock)
+        {
+            auto it = bySock.find(sock);
+            if (it == bySock.end())
+                return;
+            byPid.erase(it->second.pid);
+            if (it->second.pidfd != -1)
+            {
+                EventLoop::unwatch(it->second.pidfd);
+                close(it->second.pidfd);
+            }
+            EventLoop::unwatch(sock);
+            close(sock);
+            bySock.erase(it);
+        };
+
+        // Отвечает клиенту, если pid — завершившаяся сессия
+        auto finishSession = [&](pid_t pid, int status)
+        {
+            auto it = byPid.find(pid);
+            if (it == byPid.end())
+                return;
+            int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            int sock = it->second;
+            reply(sock, code);
+            closeSession(sock);
+        };
+
+        std::function<void(int, unsigned)> onClient = [&](int fd, unsigned events)
+        {
+            auto it = bySock.find(fd);
+            if (it == bySock.end())
+                return;
+            Session &session = it->second;
+
+            if (session.pid == 0 && (events & POLLIN))
+            {
+                int fds[3];
+                Request request;
+                if (!receiveRequest(fd, fds, request))
+                {
+                    reply(fd, 2);
+                    closeSession(fd);
+                    return;
+                }
+
+                History::append(request.kind == Line ? request.line : historyLine(request.args));
+
+                std::vector<int> inherited = {listener};
+                for (const auto &entry : bySock)
+                {
+                    inherited.push_back(entry.first);
+                    if (entry.second.pidfd != -1)
+                        inherited.push_back(entry.second.pidfd);
+                }
+                pid_t pid = startSession(fds, request, inherited);
+                for (int k = 0; k < 3; ++k)
+                    close(fds[k]);
+                if (pid == -1)
+                {
+                    std::perror("kubsh: fork failed");
+                    reply(fd, 1);
+                    closeSession(fd);
+                    return;
+                }
+                setpgid(pid, pid);
+                session.pid = pid;
+                byPid[pid] = fd;
+
+                // Завершение сессии — через pidfd; без него остаётся SIGCHLD
+                session.pidfd = EventLoop::pidfd(pid);
+                if (session.pidfd != -1)
+                {
+                    EventLoop::watch(session.pidfd, [&finishSession, pid](unsigned)
+                                     {
+                                         int status;
+                                         if (waitpid(pid, &status, WNOHANG) == pid)
+                                             finishSession(pid, status);
+                                     });
+                }
+            }
+            else if (events & (POLLHUP | POLLERR))
+            {
+                // Клиент ушёл, не дождавшись ответа — завершаем его сессию.
+                // Сама сессия закроется, когда её процесс будет собран
+                if (session.pid > 0)
+                {
+                    kill(-session.pid, SIGHUP);
+                    EventLoop::unwatch(fd);
+                    return;
+                }
+                closeSession(fd);
+            }
+            else if (events & POLLIN)
+            {
+                // После запроса от клиента ждём только разрыва соединения; лишнее отбрасываем
+                char discard[256];
+                while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+                {
+                }
+            }
+        };
+
+        EventLoop::watch(listener, [&](unsigned)
+                         {
+                             int sock;
+                             while ((sock = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC)) != -1)
+                             {
+                                 if (!samePeer(sock))
+                                 {
+                                     close(sock);
+                                     continue;
+                                 }
+                                 bySock[sock] = Session{sock, 0, -1};
+                                 EventLoop::watch(sock, [&onClient, sock](unsigned events)
+                                                  { onClient(sock, events); });
+                             }
+                         });
+
+        Signals::watch([&](int signum)
+                       {
+                           if (signum == SIGINT || signum == SIGQUIT || signum == SIGTERM)
+                           {
+                               running = false;
+                           }
+                           else if (signum == SIGCHLD)
+                           {
+                               // Сессии без pidfd собираем по SIGCHLD
+                               for (auto it = byPid.begin(); it != byPid.end();)
+                               {
+                                   pid_t pid = it->first;
+                                   int sock = it->second;
+                                   ++it;
+                                   if (bySock[sock].pidfd != -1)
+                                       continue;
+                                   int status;
+                                   if (waitpid(pid, &status, WNOHANG) == pid)
+                                       finishSession(pid, status);
+                               }
+                           }
+                       });
+
+        while (running)
+        {
+            EventLoop::runOnce();
+        }
+
+        // Незавершённые сессии получают SIGHUP, как при обрыве клиента,
+        // а их клиенты — ответ shutDown вместо молча закрытого сокета
+        std::vector<int> unfinished;
+        for (const auto &entry : bySock)
+            unfinished.push_back(entry.first);
+        for (int sock : unfinished)
+        {
+            if (bySock[sock].pid > 0)
+                kill(-bySock[sock].pid, SIGHUP);
+            reply(sock, shutDown);
+            closeSession(sock);
+        }
+
+        Signals::watch();
+        EventLoop::unwatch(listener);
+        close(listener);
+        VFS::drain();
+        unlink(path.c_str());
+        return 0;
+    }
+
+}
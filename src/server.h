@@ -0,0 +1,32 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+
+namespace Server
+{
+    // Путь сокета: $KUBSH_SOCKET, иначе $XDG_RUNTIME_DIR/kubsh.sock, иначе ~/.kubsh.sock
+    std::string socketPath();
+
+    // kubsh --server: держит прогретое состояние (история, кэш PATH, VFS) и выполняет
+    // команды клиентов. Каждая команда выполняется в дочернем процессе со stdio клиента.
+    int run();
+
+    // Ответ request(), если сервер остановили, пока команда ещё выполнялась
+    constexpr int shutDown = -2;
+
+    // Отправляет команду серверу вместе с дескрипторами fds (stdin, stdout, stderr)
+    // и ждёт её кода завершения. Возвращает -1, если сервер недоступен, и shutDown,
+    // если он завершился, не дождавшись команды.
+    int request(const std::string &command, const int fds[3]);
+
+    // То же для готового argv: аргументы передаются как есть, без разбора строки
+    int request(const std::vector<std::string> &args, const int fds[3]);
+
+    // kubsh --client args...: пересылает argv со своим stdio и возвращает код завершения.
+    // kubsh --client -c LINE пересылает строку целиком, с операторами ; && ||
+    int client(const std::vector<std::string> &args);
+}
+
+#endif // SERVER_H
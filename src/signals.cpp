@@ -1,31 +1,162 @@
 #include "signals.h"
+#include "audit.h"
+#include "config.h"
+#include "eventloop.h"
+#include "vfs.h"
 
 #include <csignal>
+#include <cstdio>
 #include <iostream>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
 namespace Signals
 {
 
-    // Обработчик сигналов
-    void handler(int signum)
+    static int sigfd = -1;
+    static pid_t foreground = 0;
+    static bool hangupExits = false;
+    static bool terminateExits = true;
+
+    static sigset_t managedSet()
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGQUIT);
+        sigaddset(&set, SIGTSTP);
+        sigaddset(&set, SIGTERM);
+        sigaddset(&set, SIGCHLD);
+        sigaddset(&set, SIGWINCH);
+        // Нужны заблокированными, чтобы tcsetpgrp() из фоновой группы не останавливал shell
+        sigaddset(&set, SIGTTOU);
+        sigaddset(&set, SIGTTIN);
+        return set;
+    }
+
+    void setup()
     {
-        if (signum == SIGHUP)
+        sigset_t set = managedSet();
+        if (sigprocmask(SIG_BLOCK, &set, nullptr) == -1)
         {
-            std::cout << "Configuration reloaded" << std::endl;
+            std::perror("kubsh: sigprocmask failed");
+            return;
         }
+
+        sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (sigfd == -1)
+        {
+            std::perror("kubsh: signalfd failed");
+            return;
+        }
+        watch();
     }
 
-    void setup()
+    int fd()
+    {
+        return sigfd;
+    }
+
+    void watch(std::function<void(int)> listener)
+    {
+        if (sigfd == -1)
+        {
+            return;
+        }
+        EventLoop::watch(sigfd, [listener](unsigned)
+                         {
+                             int signum;
+                             while ((signum = dispatch()) != 0)
+                             {
+                                 if (listener)
+                                 {
+                                     listener(signum);
+                                 }
+                             }
+                         });
+    }
+
+    int dispatch()
     {
-        struct sigaction sa{};
-        sa.sa_handler = handler;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_flags = 0;
+        if (sigfd == -1)
+        {
+            return 0;
+        }
+
+        struct signalfd_siginfo info{};
+        if (read(sigfd, &info, sizeof(info)) != static_cast<ssize_t>(sizeof(info)))
+        {
+            return 0;
+        }
 
-        if (sigaction(SIGHUP, &sa, nullptr) == -1)
+        int signum = static_cast<int>(info.ssi_signo);
+        switch (signum)
         {
-            std::perror("kubsh: sigaction failed");
+        case SIGHUP:
+            if (hangupExits)
+            {
+                if (foreground > 0)
+                {
+                    kill(-foreground, SIGHUP);
+                }
+                // Прерванная команда и всё накопленное в памяти — в журнал аудита
+                Audit::end(128 + SIGHUP);
+                Audit::flush();
+                _exit(128 + SIGHUP);
+            }
+            if (Config::reload())
+            {
+                std::cout << "Configuration reloaded" << std::endl;
+                VFS::followConfig();
+            }
+            break;
+        case SIGTERM:
+            if (terminateExits)
+            {
+                if (foreground > 0)
+                {
+                    kill(-foreground, SIGTERM);
+                }
+                // Без signalfd процесс умер бы сразу; с ним — успеваем сохранить журнал аудита
+                Audit::end(128 + SIGTERM);
+                Audit::flush();
+                _exit(128 + SIGTERM);
+            }
+            break;
+        case SIGINT:
+        case SIGQUIT:
+        case SIGTSTP:
+            if (foreground > 0)
+            {
+                kill(-foreground, signum);
+            }
+            break;
+        default:
+            break;
         }
+        return signum;
+    }
+
+    void setForeground(pid_t pgid)
+    {
+        foreground = pgid;
+    }
+
+    void setHangupExits(bool enable)
+    {
+        hangupExits = enable;
+    }
+
+    void setTerminateExits(bool enable)
+    {
+        terminateExits = enable;
+    }
+
+    void resetForChild()
+    {
+        sigset_t set = managedSet();
+        sigprocmask(SIG_UNBLOCK, &set, nullptr);
     }
 
 }
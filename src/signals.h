@@ -1,10 +1,44 @@
 #ifndef SIGNALS_H
 #define SIGNALS_H
 
+#include <functional>
+#include <sys/types.h>
+
 namespace Signals
 {
-    // Регистрирует обработчики сигналов
+    // Блокирует управляемые сигналы и направляет их в signalfd.
+    // Должна вызываться до запуска любых потоков, чтобы они унаследовали маску.
     void setup();
+
+    // Дескриптор signalfd для poll в главном цикле
+    int fd();
+
+    // Подписывает signalfd на EventLoop: каждый пришедший сигнал проходит dispatch(),
+    // затем передаётся listener. Повторный вызов заменяет listener; без аргумента —
+    // только общая реакция. setup() вызывает watch() сам; после
+    // EventLoop::resetAfterFork() подписку нужно повторить.
+    void watch(std::function<void(int)> listener = nullptr);
+
+    // Забирает один ожидающий сигнал и выполняет общую реакцию
+    // (SIGHUP — перечитать конфигурацию, SIGINT/SIGTSTP — переслать группе переднего плана,
+    // SIGTERM — переслать ей же, сбросить журнал аудита и завершиться).
+    // Возвращает номер сигнала или 0, если ожидающих сигналов нет.
+    int dispatch();
+
+    // Группа процессов, которой пересылаются SIGINT/SIGTSTP; 0 — нет
+    void setForeground(pid_t pgid);
+
+    // Для сессий сервера: SIGHUP означает обрыв клиента, а не перечитывание конфигурации —
+    // он пересылается группе переднего плана и завершает процесс
+    void setHangupExits(bool enable);
+
+    // false — SIGTERM не завершает процесс в dispatch(), а только передаётся listener
+    // (сервер сам закрывает сессии перед выходом); по умолчанию true
+    void setTerminateExits(bool enable);
+
+    // Вызывается в дочернем процессе между fork и exec:
+    // снимает блокировку сигналов, унаследованную от kubsh
+    void resetForChild();
 }
 
 #endif // SIGNALS_H
@@ -1,20 +1,34 @@
 #include "vfs.h"
+#include "config.h"
+#include "signals.h"
+#include "eventloop.h"
 
 #include <iostream>
 #include <filesystem>
 #include <cstdlib>
 #include <string>
-#include <thread>
 #include <unistd.h>
 #include <sys/inotify.h>
 #include <vector>
 #include <sys/wait.h>
 #include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
 #include <pwd.h>
+#include <sys/stat.h>
 
 namespace VFS
 {
-    static std::string getUsersDir()
+    static std::string homeUsersDir;
+
+    static std::string getHomeUsersDir()
     {
         const char *home = std::getenv("HOME");
         if (!home)
@@ -27,40 +41,81 @@ namespace VFS
         return path.string();
     }
 
-    static bool runCommand(const std::vector<std::string> &args)
+    // Каталог из конфигурации имеет приоритет; может смениться после SIGHUP
+    static std::string getUsersDir()
     {
-        pid_t pid = fork();
-        if (pid == 0)
+        std::string dir = Config::current()->usersDir;
+        return dir.empty() ? homeUsersDir : dir;
+    }
+
+    struct UserInfo
+    {
+        std::string uid;
+        std::string home;
+        std::string shell;
+    };
+
+    // Разобранный /etc/passwd. Строится при первом обращении и перечитывается,
+    // когда меняется mtime файла (adduser/deluser его переписывают)
+    static std::unordered_map<std::string, UserInfo> passwdMap;
+    static struct timespec passwdMtime{};
+    static bool passwdLoaded = false;
+
+    static void refreshPasswdMap()
+    {
+        struct stat st{};
+        if (stat("/etc/passwd", &st) == -1)
         {
-            std::vector<char *> argv;
-            for (const auto &a : args)
-                argv.push_back(const_cast<char *>(a.c_str()));
-            argv.push_back(nullptr);
-            execvp(argv[0], argv.data());
-            std::perror(("kubsh: exec " + args[0]).c_str());
-            _exit(127);
+            return;
         }
-        else if (pid > 0)
+        if (passwdLoaded && st.st_mtim.tv_sec == passwdMtime.tv_sec && st.st_mtim.tv_nsec == passwdMtime.tv_nsec)
         {
-            int status = 0;
-            waitpid(pid, &status, 0);
-            return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            return;
         }
-        else
+
+        passwdMap.clear();
+        std::ifstream infile("/etc/passwd");
+        std::string line;
+        while (std::getline(infile, line))
         {
-            std::perror("kubsh: fork failed");
-            return false;
+            // name:passwd:uid:gid:gecos:home:shell
+            std::vector<std::string> fields;
+            std::size_t begin = 0;
+            while (true)
+            {
+                std::size_t end = line.find(':', begin);
+                fields.push_back(line.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+                if (end == std::string::npos)
+                    break;
+                begin = end + 1;
+            }
+            if (fields.size() == 7)
+            {
+                passwdMap[fields[0]] = UserInfo{fields[2], fields[5], fields[6]};
+            }
         }
+        passwdMtime = st.st_mtim;
+        passwdLoaded = true;
     }
 
-    static bool addSystemUser(const std::string &name)
+    static bool lookupUser(const std::string &name, UserInfo &info)
     {
-        return runCommand({"adduser", "-D", "-s", "/bin/bash", name});
-    }
+        refreshPasswdMap();
+        auto it = passwdMap.find(name);
+        if (it != passwdMap.end())
+        {
+            info = it->second;
+            return true;
+        }
 
-    static bool delSystemUser(const std::string &name)
-    {
-        return runCommand({"deluser", name});
+        // Пользователь может приходить не из /etc/passwd (NSS), спрашиваем libc
+        struct passwd *pwd = getpwnam(name.c_str());
+        if (!pwd)
+        {
+            return false;
+        }
+        info = UserInfo{std::to_string(pwd->pw_uid), pwd->pw_dir, pwd->pw_shell};
+        return true;
     }
 
     static void createUserFiles(const std::string &userDir, const std::string &username)
@@ -77,15 +132,16 @@ namespace VFS
             }
         }
 
-        struct passwd *pwd = getpwnam(username.c_str());
+        UserInfo info;
+        bool found = lookupUser(username, info);
 
         try
         {
-            if (pwd)
+            if (found)
             {
-                std::ofstream(userDir + "/id") << pwd->pw_uid;
-                std::ofstream(userDir + "/home") << pwd->pw_dir;
-                std::ofstream(userDir + "/shell") << pwd->pw_shell;
+                std::ofstream(userDir + "/id") << info.uid;
+                std::ofstream(userDir + "/home") << info.home;
+                std::ofstream(userDir + "/shell") << info.shell;
             }
             else
             {
@@ -101,74 +157,417 @@ namespace VFS
         }
     }
 
-    static void monitorUsersDir(const std::string &path)
+    // Каталоги первого уровня в dir — это и есть пользователи
+    static bool listUserDirs(const std::string &dir, std::unordered_set<std::string> &names)
+    {
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+        {
+            return false;
+        }
+        while (struct dirent *entry = readdir(d))
+        {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+
+            bool isDir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN)
+            {
+                struct stat st{};
+                isDir = fstatat(dirfd(d), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (isDir)
+                names.insert(std::move(name));
+        }
+        closedir(d);
+        return true;
+    }
+
+    // Наблюдение за каталогом пользователей живёт в EventLoop главного потока.
+    // События не исполняются по одному: имена копятся в dirty и сверяются с тем, что
+    // реально лежит на диске (см. scheduleFlush), — так create+delete одного имени
+    // в пределах пачки ничего не стоят, а повторы схлопываются.
+    static constexpr long coalesceMs = 20;
+    static constexpr int immediateFlushes = 16;
+
+    static int inotifyFd = -1;
+    static int timerFd = -1;
+    static int watchWd = -1;
+    static std::string watchedPath;
+    static std::string rejectedPath;
+    static bool monitoring = false;
+
+    static std::unordered_set<std::string> known;                 // пользователи, заведённые по каталогам
+    static std::unordered_set<std::string> dirty;                 // имена, которые нужно сверить
+    static std::unordered_map<std::uint32_t, std::string> movedFrom; // cookie IN_MOVED_FROM → старое имя
+    static std::vector<std::pair<std::string, std::string>> renames;
+    static bool overflowed = false;
+    static bool flushArmed = false;
+    static std::chrono::steady_clock::time_point windowStart;
+    static int flushesInWindow = 0;
+
+    static bool isUserDir(const std::string &name)
+    {
+        struct stat st{};
+        return lstat((watchedPath + "/" + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    // ===== user tools =====
+
+    // adduser/deluser/usermod не ждут в обработчике событий: каждый запуск — задача в
+    // очереди, завершение приходит через pidfd. Все они переписывают /etc/passwd под
+    // одним замком и, не взяв его, сразу завершаются с ошибкой, поэтому очередь общая и
+    // задачи идут строго по одной: параллельные запуски теряли бы пользователей
+
+    struct ToolOp
+    {
+        enum class Kind
+        {
+            Add,
+            Del,
+            Rename, // name -> to; при неудаче usermod — deluser name и adduser to
+        } kind;
+        std::string name;
+        std::string to;
+        int step = 0;
+    };
+
+    static std::deque<ToolOp> toolQueue;
+    static std::unordered_map<int, ToolOp> runningTools; // pidfd → задача, не больше одной
+
+    static std::vector<std::string> toolArgs(const ToolOp &op)
+    {
+        switch (op.kind)
+        {
+        case ToolOp::Kind::Add:
+            return {"adduser", "-D", "-s", "/bin/bash", op.name};
+        case ToolOp::Kind::Del:
+            return {"deluser", op.name};
+        case ToolOp::Kind::Rename:
+            if (op.step == 0)
+                return {"usermod", "-l", op.to, op.name};
+            if (op.step == 1)
+                return {"deluser", op.name};
+            return {"adduser", "-D", "-s", "/bin/bash", op.to};
+        }
+        return {};
+    }
+
+    // Запускает инструмент; -1 — не удалось. argv собирается до fork
+    static pid_t startTool(const std::vector<std::string> &args)
+    {
+        std::vector<char *> argv;
+        for (const auto &a : args)
+            argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            Signals::resetForChild();
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        if (pid == -1)
+        {
+            std::perror("kubsh: fork failed");
+        }
+        return pid;
+    }
+
+    static void pumpTools();
+
+    // Шаг задачи завершился с результатом ok; false — задача выполнена целиком
+    static bool advance(ToolOp &op, bool ok, int exitCode)
     {
-        int fd = inotify_init1(IN_NONBLOCK);
-        if (fd == -1)
+        switch (op.kind)
         {
-            std::perror("kubsh: inotify_init1 failed");
+        case ToolOp::Kind::Add:
+            if (!ok)
+                std::cerr << "kubsh: failed to add user " << op.name << " (exit " << exitCode << ")" << std::endl;
+            // Каталог мог исчезнуть, пока работал adduser, — не воссоздаём его
+            if (isUserDir(op.name))
+                createUserFiles(watchedPath + "/" + op.name, op.name);
+            return false;
+        case ToolOp::Kind::Del:
+            return false;
+        case ToolOp::Kind::Rename:
+            if (op.step == 0 && ok)
+                op.step = 3;
+            else
+                ++op.step;
+            if (op.step == 3 && !ok)
+                std::cerr << "kubsh: failed to add user " << op.to << " (exit " << exitCode << ")" << std::endl;
+            if (op.step < 3)
+                return true;
+            if (isUserDir(op.to))
+                createUserFiles(watchedPath + "/" + op.to, op.to);
+            return false;
+        }
+        return false;
+    }
+
+    static void runStep(ToolOp op);
+
+    static void toolDone(int pidfd, pid_t pid)
+    {
+        int status = 0;
+        if (waitpid(pid, &status, WNOHANG) != pid)
             return;
+        EventLoop::unwatch(pidfd);
+        close(pidfd);
+
+        auto it = runningTools.find(pidfd);
+        ToolOp op = std::move(it->second);
+        runningTools.erase(it);
+
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        if (advance(op, ok, code))
+            runStep(std::move(op));
+        pumpTools();
+    }
+
+    // Запускает очередной шаг задачи; без pidfd (старое ядро) ждёт его здесь же
+    static void runStep(ToolOp op)
+    {
+        while (true)
+        {
+            pid_t pid = startTool(toolArgs(op));
+            int pidfd = pid > 0 ? EventLoop::pidfd(pid) : -1;
+            if (pidfd != -1)
+            {
+                runningTools.emplace(pidfd, std::move(op));
+                EventLoop::watch(pidfd, [pidfd, pid](unsigned)
+                                 { toolDone(pidfd, pid); });
+                return;
+            }
+
+            int status = 0;
+            bool ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            int code = pid > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : 127;
+            if (!advance(op, ok, code))
+                return;
         }
+    }
 
-        int wd = inotify_add_watch(fd, path.c_str(), IN_CREATE | IN_DELETE);
-        if (wd == -1)
+    // Запускает следующую задачу из очереди, если ни одна сейчас не выполняется
+    static void pumpTools()
+    {
+        while (runningTools.empty() && !toolQueue.empty())
         {
-            std::perror("kubsh: inotify_add_watch failed");
-            close(fd);
+            ToolOp op = std::move(toolQueue.front());
+            toolQueue.pop_front();
+            runStep(std::move(op));
+        }
+    }
+
+    static void enqueue(ToolOp op)
+    {
+        toolQueue.push_back(std::move(op));
+        pumpTools();
+    }
+
+    static void provision(const std::string &name)
+    {
+        std::cout << "[vfs] detected new folder: " << name << std::endl;
+        known.insert(name);
+        enqueue(ToolOp{ToolOp::Kind::Add, name, std::string()});
+    }
+
+    static void deprovision(const std::string &name)
+    {
+        std::cout << "[vfs] detected removed folder: " << name << std::endl;
+        known.erase(name);
+        enqueue(ToolOp{ToolOp::Kind::Del, name, std::string()});
+    }
+
+    // Приводит пользователя name в соответствие с каталогом
+    static void reconcile(const std::string &name)
+    {
+        bool present = isUserDir(name);
+        bool have = known.count(name) != 0;
+        if (present && !have)
+        {
+            provision(name);
+        }
+        else if (!present && have)
+        {
+            deprovision(name);
+        }
+    }
+
+    // Полная сверка после переполнения очереди inotify: один проход readdir и
+    // разность с known, без stat на каждый каталог
+    static void rescan()
+    {
+        std::unordered_set<std::string> present;
+        if (!listUserDirs(watchedPath, present))
+        {
+            std::perror(("kubsh: rescan " + watchedPath).c_str());
+            return;
+        }
+
+        std::vector<std::string> gone;
+        for (const auto &name : known)
+        {
+            if (!present.count(name))
+                gone.push_back(name);
+        }
+        for (const auto &name : gone)
+        {
+            deprovision(name);
+        }
+        for (const auto &name : present)
+        {
+            if (!known.count(name))
+                provision(name);
+        }
+    }
+
+    static void flush(unsigned)
+    {
+        std::uint64_t expirations;
+        while (read(timerFd, &expirations, sizeof(expirations)) > 0)
+        {
+        }
+        flushArmed = false;
+
+        if (overflowed)
+        {
+            std::cerr << "kubsh: [vfs] inotify queue overflow, rescanning " << watchedPath << std::endl;
+            overflowed = false;
+            renames.clear();
+            movedFrom.clear();
+            dirty.clear();
+            rescan();
+            return;
+        }
+
+        // Переименование каталога — переименование пользователя, если оба конца
+        // уже устоялись; иначе имена сверяются по отдельности
+        for (const auto &rename : renames)
+        {
+            const std::string &from = rename.first;
+            const std::string &to = rename.second;
+            if (!known.count(from) || known.count(to) || isUserDir(from) || !isUserDir(to))
+                continue;
+
+            std::cout << "[vfs] detected renamed folder: " << from << " -> " << to << std::endl;
+            known.erase(from);
+            known.insert(to);
+            enqueue(ToolOp{ToolOp::Kind::Rename, from, to});
+            dirty.erase(from);
+            dirty.erase(to);
+        }
+        renames.clear();
+        movedFrom.clear(); // IN_MOVED_FROM без пары — каталог унесли наружу, он уже в dirty
+
+        std::unordered_set<std::string> batch;
+        batch.swap(dirty);
+        for (const auto &name : batch)
+        {
+            reconcile(name);
+        }
+    }
+
+    // Первые immediateFlushes сверок в каждом окне coalesceMs выполняются сразу, по
+    // прочитанной пачке: одиночные события не ждут. Когда события идут чаще, остальные
+    // копятся до конца окна и сверяются одним проходом. Непарный IN_MOVED_FROM тоже
+    // ждёт: его IN_MOVED_TO может прийти следующим read
+    static void scheduleFlush()
+    {
+        if (flushArmed)
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        auto windowEnd = windowStart + std::chrono::milliseconds(coalesceMs);
+        if (now >= windowEnd)
+        {
+            windowStart = now;
+            windowEnd = now + std::chrono::milliseconds(coalesceMs);
+            flushesInWindow = 0;
+        }
+        if (flushesInWindow < immediateFlushes && movedFrom.empty())
+        {
+            ++flushesInWindow;
+            flush(0);
             return;
         }
 
-        constexpr size_t buf_len = 4096;
-        std::vector<char> buffer(buf_len);
+        struct itimerspec spec{};
+        spec.it_value.tv_nsec = std::max(1L, static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(windowEnd - now).count()));
+        if (timerfd_settime(timerFd, 0, &spec, nullptr) == 0)
+        {
+            flushArmed = true;
+        }
+        else
+        {
+            flush(0);
+        }
+    }
+
+    static void handleEvents(unsigned)
+    {
+        // Большой буфер: при всплеске создания каталогов за один read приходят тысячи событий
+        alignas(struct inotify_event) static char buffer[256 * 1024];
 
+        bool any = false;
         while (true)
         {
-            ssize_t len = read(fd, buffer.data(), buffer.size());
+            ssize_t len = read(inotifyFd, buffer, sizeof(buffer));
             if (len <= 0)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(200));
-                continue;
+                break;
             }
 
             ssize_t i = 0;
             while (i < len)
             {
                 struct inotify_event *event = reinterpret_cast<struct inotify_event *>(&buffer[i]);
+                i += sizeof(struct inotify_event) + event->len;
 
-                if (event->len > 0)
+                if (event->mask & IN_Q_OVERFLOW)
                 {
-                    std::string name(event->name);
-                    std::string userDir = path + "/" + name;
-
-                    if (event->mask & IN_CREATE)
-                    {
-                        std::cout << "[vfs] detected new folder: " << name << std::endl;
-
-                        if (!addSystemUser(name))
-                        {
-                            std::cerr << "kubsh: failed to add user " << name << std::endl;
-                        }
+                    overflowed = true;
+                    any = true;
+                    continue;
+                }
+                // Файлы в каталоге пользователей и события прежнего каталога не интересны
+                if (event->wd != watchWd || event->len == 0 || !(event->mask & IN_ISDIR))
+                {
+                    continue;
+                }
 
-                        createUserFiles(userDir, name);
-                    }
-                    else if (event->mask & IN_DELETE)
+                std::string name(event->name);
+                if (event->mask & IN_MOVED_FROM)
+                {
+                    movedFrom[event->cookie] = name;
+                }
+                else if (event->mask & IN_MOVED_TO)
+                {
+                    auto it = movedFrom.find(event->cookie);
+                    if (it != movedFrom.end())
                     {
-                        std::cout << "[vfs] detected removed folder: " << name << std::endl;
-                        delSystemUser(name);
+                        renames.emplace_back(it->second, name);
+                        movedFrom.erase(it);
                     }
                 }
-
-                i += sizeof(struct inotify_event) + event->len;
+                dirty.insert(std::move(name));
+                any = true;
             }
         }
 
-        close(fd);
+        if (any)
+        {
+            scheduleFlush();
+        }
     }
 
-    void initUsers()
+    // Создаёт каталог при необходимости и досоздаёт файлы уже существующих пользователей
+    static bool prepareUsersDir(const std::string &dir, std::unordered_set<std::string> &names)
     {
-        std::string dir = getUsersDir();
-
         try
         {
             if (!std::filesystem::exists(dir))
@@ -179,22 +578,97 @@ namespace VFS
         catch (const std::exception &e)
         {
             std::cerr << "kubsh: failed to create users dir: " << e.what() << std::endl;
-            return;
+            return false;
         }
 
         // Проверяем существующие каталоги пользователей
-        for (auto &entry : std::filesystem::directory_iterator(dir))
+        if (!listUserDirs(dir, names))
+        {
+            std::perror(("kubsh: " + dir).c_str());
+            return false;
+        }
+        for (const auto &name : names)
+        {
+            createUserFiles(dir + "/" + name, name);
+        }
+        return true;
+    }
+
+    // Ставит наблюдение на текущий каталог пользователей (или переносит его туда)
+    static void followUsersDir()
+    {
+        std::string wanted = getUsersDir();
+        if ((inotifyFd != -1 && wanted == watchedPath) || wanted == rejectedPath)
         {
-            if (entry.is_directory())
+            return;
+        }
+
+        std::unordered_set<std::string> existing;
+        if (!prepareUsersDir(wanted, existing))
+        {
+            rejectedPath = wanted;
+            return;
+        }
+        rejectedPath.clear();
+
+        if (inotifyFd == -1)
+        {
+            inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (inotifyFd == -1 || timerFd == -1)
             {
-                std::string name = entry.path().filename().string();
-                createUserFiles(entry.path().string(), name);
+                std::perror("kubsh: inotify_init1 failed");
+                return;
             }
+            EventLoop::watch(inotifyFd, handleEvents);
+            EventLoop::watch(timerFd, flush);
+        }
+
+        int wd = inotify_add_watch(inotifyFd, wanted.c_str(),
+                                   IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+        if (wd == -1)
+        {
+            std::perror("kubsh: inotify_add_watch failed");
+            return;
         }
+        if (watchWd != -1 && watchWd != wd)
+        {
+            inotify_rm_watch(inotifyFd, watchWd);
+        }
+        watchWd = wd;
+        watchedPath = wanted;
+
+        // Несведённые события относились к прежнему каталогу
+        known.swap(existing);
+        dirty.clear();
+        renames.clear();
+        movedFrom.clear();
+    }
 
-        // Запускаем мониторинг в отдельном потоке
-        std::thread monitorThread(monitorUsersDir, dir);
-        monitorThread.detach();
+    void initUsers()
+    {
+        homeUsersDir = getHomeUsersDir();
+        monitoring = true;
+
+        // Начальный обход каталога — первой задачей EventLoop, а не здесь,
+        // чтобы не задерживать первое приглашение
+        EventLoop::post(followUsersDir);
+    }
+
+    void drain()
+    {
+        while (!toolQueue.empty() || !runningTools.empty())
+        {
+            EventLoop::runOnce(100);
+        }
+    }
+
+    void followConfig()
+    {
+        if (monitoring)
+        {
+            followUsersDir();
+        }
     }
 
 }
@@ -3,8 +3,16 @@
 
 namespace VFS
 {
-    // Создаёт ~/users и запускает мониторинг
+    // Запускает мониторинг ~/users в EventLoop: создание каталога и начальный обход
+    // выполняются первой задачей цикла, события inotify — его обработчиком
     void initUsers();
+
+    // Дожидается запущенных и отложенных adduser/deluser/usermod; вызывается перед выходом,
+    // чтобы пользователи для уже замеченных каталогов не остались незаведёнными
+    void drain();
+
+    // Переносит наблюдение, если users_dir сменился после перечитывания конфигурации
+    void followConfig();
 }
 
 #endif // VFS_H
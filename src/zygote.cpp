@@ -0,0 +1,355 @@
+#include "zygote.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+namespace Zygote
+{
+
+    // Запрос — одно сообщение SOCK_SEQPACKET: заголовок, затем строки через '\0':
+    // program, cwd, argv[0..argc), env[0..envc). В SCM_RIGHTS — stdin, stdout, stderr.
+    struct RequestHeader
+    {
+        std::uint32_t terminal;
+        std::uint32_t argc;
+        std::uint32_t envc;
+    };
+
+    // Ответы помощника: сначала Started (pid или -1 и errno), затем Status
+    enum ReplyType : std::int32_t
+    {
+        Started = 1,
+        Status = 2,
+    };
+
+    struct Reply
+    {
+        std::int32_t type;
+        std::int32_t pid;
+        std::int32_t value;
+    };
+
+    static constexpr std::size_t maxRequest = 256 * 1024;
+
+    static int sock = -1;
+    static pid_t owner = 0;
+
+    bool start(const std::string &self)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1)
+        {
+            std::perror("kubsh: socketpair failed");
+            return false;
+        }
+        int size = static_cast<int>(maxRequest);
+        setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(pair[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            std::perror("kubsh: fork failed");
+            close(pair[0]);
+            close(pair[1]);
+            return false;
+        }
+
+        if (pid == 0)
+        {
+            // Сразу exec: помощнику не нужно ничего из адресного пространства kubsh
+            close(pair[0]);
+            int flags = fcntl(pair[1], F_GETFD);
+            fcntl(pair[1], F_SETFD, flags & ~FD_CLOEXEC);
+
+            sigset_t all;
+            sigfillset(&all);
+            sigprocmask(SIG_UNBLOCK, &all, nullptr);
+
+            std::string fdArg = std::to_string(pair[1]);
+            execl(self.c_str(), "kubsh", "--zygote-helper", fdArg.c_str(), nullptr);
+            _exit(127);
+        }
+
+        close(pair[1]);
+        sock = pair[0];
+        owner = getpid();
+        return true;
+    }
+
+    bool available()
+    {
+        return sock != -1 && owner == getpid();
+    }
+
+    int fd()
+    {
+        return sock;
+    }
+
+    pid_t spawn(const std::string &program, const std::vector<std::string> &argv, bool terminal)
+    {
+        char cwd[4096];
+        if (!getcwd(cwd, sizeof(cwd)))
+        {
+            return -1;
+        }
+
+        RequestHeader header{terminal ? 1u : 0u, static_cast<std::uint32_t>(argv.size()), 0};
+        std::string payload(reinterpret_cast<const char *>(&header), sizeof(header));
+        payload.append(program).push_back('\0');
+        payload.append(cwd).push_back('\0');
+        for (const auto &arg : argv)
+        {
+            payload.append(arg).push_back('\0');
+        }
+        for (char **env = environ; *env; ++env)
+        {
+            payload.append(*env).push_back('\0');
+            ++header.envc;
+        }
+        std::memcpy(payload.data(), &header, sizeof(header));
+
+        if (payload.size() > maxRequest)
+        {
+            return -1;
+        }
+
+        const int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(fds))];
+            struct cmsghdr align;
+        } control{};
+
+        struct iovec iov{payload.data(), payload.size()};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1)
+        {
+            return -1;
+        }
+
+        Reply reply{};
+        ssize_t n;
+        do
+        {
+            n = recv(sock, &reply, sizeof(reply), 0);
+        } while (n == -1 && errno == EINTR);
+
+        if (n != static_cast<ssize_t>(sizeof(reply)) || reply.type != Started)
+        {
+            return -1;
+        }
+        if (reply.pid == -1)
+        {
+            errno = reply.value;
+        }
+        return reply.pid;
+    }
+
+    pid_t readStatus(int &status)
+    {
+        Reply reply{};
+        ssize_t n;
+        do
+        {
+            n = recv(sock, &reply, sizeof(reply), 0);
+        } while (n == -1 && errno == EINTR);
+
+        if (n != static_cast<ssize_t>(sizeof(reply)) || reply.type != Status)
+        {
+            return -1;
+        }
+        status = reply.value;
+        return reply.pid;
+    }
+
+    // ===== helper =====
+
+    static void sendReply(int fd, ReplyType type, pid_t pid, int value)
+    {
+        Reply reply{type, pid, value};
+        send(fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+    }
+
+    static bool receiveRequest(int fd, std::vector<char> &buf, int fds[3], ssize_t &length)
+    {
+        union
+        {
+            char buf[CMSG_SPACE(3 * sizeof(int))];
+            struct cmsghdr align;
+        } control{};
+
+        struct iovec iov{buf.data(), buf.size()};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        do
+        {
+            length = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        } while (length == -1 && errno == EINTR);
+
+        if (length <= 0)
+        {
+            return false;
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        {
+            fds[0] = fds[1] = fds[2] = -1;
+            return true;
+        }
+        std::memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+        return true;
+    }
+
+    // Разбирает запрос в указатели на строки внутри buf
+    static bool parseRequest(std::vector<char> &buf, std::size_t length, RequestHeader &header,
+                             std::vector<char *> &strings)
+    {
+        if (length < sizeof(header) || buf[length - 1] != '\0')
+        {
+            return false;
+        }
+        std::memcpy(&header, buf.data(), sizeof(header));
+
+        for (std::size_t pos = sizeof(header); pos < length;)
+        {
+            strings.push_back(buf.data() + pos);
+            pos += std::strlen(buf.data() + pos) + 1;
+        }
+        return strings.size() == 2 + std::size_t(header.argc) + header.envc && header.argc > 0;
+    }
+
+    int serve(int fd)
+    {
+        // Помощник живёт ровно столько, сколько kubsh
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        prctl(PR_SET_NAME, "kubsh-zygote");
+        if (getppid() == 1)
+        {
+            return 0;
+        }
+
+        // Своя группа: Ctrl+C в терминале не должен доставаться помощнику
+        setpgid(0, 0);
+
+        // tcsetpgrp() в потомке выполняется из фоновой группы
+        sigset_t ttou;
+        sigemptyset(&ttou);
+        sigaddset(&ttou, SIGTTOU);
+        sigaddset(&ttou, SIGTTIN);
+        sigprocmask(SIG_BLOCK, &ttou, nullptr);
+
+        std::vector<char> buf(maxRequest);
+        while (true)
+        {
+            // Остановленные и брошенные kubsh потомки дособираются здесь
+            while (waitpid(-1, nullptr, WNOHANG) > 0)
+            {
+            }
+
+            int fds[3];
+            ssize_t length = 0;
+            if (!receiveRequest(fd, buf, fds, length))
+            {
+                return 0; // kubsh закрыл сокет
+            }
+
+            RequestHeader header{};
+            std::vector<char *> strings;
+            if (fds[0] == -1 || !parseRequest(buf, static_cast<std::size_t>(length), header, strings))
+            {
+                for (int i = 0; i < 3; ++i)
+                    if (fds[i] != -1)
+                        close(fds[i]);
+                sendReply(fd, Started, -1, EINVAL);
+                continue;
+            }
+
+            char *program = strings[0];
+            char *cwd = strings[1];
+            std::vector<char *> argv(strings.begin() + 2, strings.begin() + 2 + header.argc);
+            argv.push_back(nullptr);
+            std::vector<char *> envp(strings.begin() + 2 + header.argc, strings.end());
+            envp.push_back(nullptr);
+
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                setpgid(0, 0);
+                for (int i = 0; i < 3; ++i)
+                {
+                    dup2(fds[i], i);
+                }
+                if (header.terminal)
+                {
+                    tcsetpgrp(STDIN_FILENO, getpid());
+                }
+                sigprocmask(SIG_UNBLOCK, &ttou, nullptr);
+
+                if (chdir(cwd) == -1)
+                {
+                    std::perror("kubsh: chdir");
+                }
+
+                if (std::strcmp(program, argv[0]) != 0)
+                {
+                    execve(program, argv.data(), envp.data());
+                }
+                execvpe(argv[0], argv.data(), envp.data());
+                std::perror("kubsh: command not found");
+                _exit(127);
+            }
+
+            int err = errno;
+            for (int i = 0; i < 3; ++i)
+                close(fds[i]);
+
+            if (pid < 0)
+            {
+                sendReply(fd, Started, -1, err);
+                continue;
+            }
+
+            setpgid(pid, pid);
+            sendReply(fd, Started, pid, 0);
+
+            int status = 0;
+            pid_t r;
+            do
+            {
+                r = waitpid(pid, &status, WUNTRACED);
+            } while (r == -1 && errno == EINTR);
+            sendReply(fd, Status, pid, r == pid ? status : (127 << 8));
+        }
+    }
+
+}
@@ -0,0 +1,32 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+namespace Zygote
+{
+    // Запускает помощника: отдельный однопоточный процесс (self --zygote-helper FD),
+    // который по запросу делает fork + exec из своего маленького адресного пространства.
+    // Время запуска команд тогда не зависит от размера кучи и числа потоков kubsh.
+    bool start(const std::string &self);
+
+    // Точка входа помощника; fd — его конец socketpair
+    int serve(int fd);
+
+    // true, если помощник запущен этим процессом (в fork-нутых потомках — false)
+    bool available();
+
+    // Запускает program с argv в текущем каталоге, окружении и stdio kubsh.
+    // terminal — передать ли дочерней группе терминал. Возвращает pid или -1.
+    pid_t spawn(const std::string &program, const std::vector<std::string> &argv, bool terminal);
+
+    // Дескриптор, по которому приходят статусы запущенных команд
+    int fd();
+
+    // Читает очередной статус (в формате waitpid). Возвращает pid или -1 при ошибке.
+    pid_t readStatus(int &status);
+}
+
+#endif // ZYGOTE_H